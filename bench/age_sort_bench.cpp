@@ -0,0 +1,140 @@
+//
+//  age_sort_bench.cpp
+//  thread_support
+//
+//  Benchmark of the age sorter's two modes: online, through a
+//  thread_priority_queue fed by producer threads, against offline, with
+//  parallel_radix_sort over every record at once.
+//  argv[1] is the number of records to sort (default 10,000,000; the data
+//  set is meant to scale to 100,000,000). argv[2..] are people files whose
+//  ages are replicated up to that count (default output/people{1..5}.txt).
+//  Parsing is left out of both timings; only the sort itself is measured.
+//  Each timing is followed by its hardware counters per record
+//  (perf_counters.hpp): the radix sort with its workers, and the heap per
+//  producer and for the popping thread. Counters the machine lacks show "-".
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include "thread_priority_queue.hpp"
+#include "radix_sort.hpp"
+#include "people.hpp"
+#include "perf_counters.hpp"
+
+using namespace david::thread;
+using namespace david::people;
+using Clock = std::chrono::steady_clock;
+
+std::vector<age_key> load_ages(const std::vector<std::string>& fileNames) {
+    std::vector<age_key> ages;
+    for (auto&& name : fileNames) {
+        std::ifstream in(name);
+        std::string line;
+        std::getline(in, line); // the count
+        unsigned short y, m, d;
+        while (std::getline(in, line)) {
+            std::stringstream ss(line);
+            if (ss >> y >> m >> d) ages.push_back(pack_age(y, m, d));
+        }
+    }
+    return ages;
+}
+
+double seconds_since(Clock::time_point t0) {
+    return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+void report(const char* mode, std::size_t n, double secs) {
+    std::cout << mode << ": " << n << " records in " << secs << " s ("
+        << n / secs / 1e6 << " M records/s)" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t n = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+    std::vector<std::string> fileNames (argv + (argc > 2 ? 2 : argc), argv +
+        argc);
+    if (fileNames.empty())
+        for (unsigned i = 1; i <= 5; ++i)
+            fileNames.push_back("output/people" + std::to_string(i) + ".txt");
+    auto ages = load_ages(fileNames);
+    if (ages.empty() || n == 0) {
+        std::cerr << "No records to sort.\n";
+        return 1;
+    }
+
+    std::vector<heap_entry> entries (n);
+    for (std::size_t i = 0; i < n; ++i)
+        entries[i] = heap_entry {ages[i % ages.size()], std::uint32_t(i)};
+    unsigned hwc = std::thread::hardware_concurrency();
+    unsigned producers = (hwc > 1 ? hwc - 1 : 1);
+    std::cout << n << " records, " << ages.size() << " distinct rows, "
+        << producers << " producer threads." << std::endl;
+
+    // offline: one radix sort over everything, oldest first, stable
+    std::vector<heap_entry> sorted (entries);
+    perf::region offline ("offline radix", true, true);
+    Clock::time_point t0;
+    double secs;
+    {
+        perf::scope counted (offline, n);
+        // a pool of its own, started and joined inside the scope, so that
+        // the counters take in its workers; the timing leaves out its start
+        task_pool pool (task_pool::shared().concurrency() - 1);
+        t0 = Clock::now();
+        parallel_radix_sort(sorted, [](const heap_entry& e) {
+            return ~e.key;
+        }, pool);
+        secs = seconds_since(t0);
+    }
+    report("offline radix", n, secs);
+    offline.report(std::cout);
+    for (std::size_t i = 1; i < n; ++i) {
+        if (sorted[i - 1] < sorted[i]) {
+            std::cerr << "offline radix sort is out of order at " << i << '\n';
+            return 2;
+        }
+    }
+
+    // online: producers push slices while the main thread pops
+    std::vector<heap_entry> storage;
+    storage.reserve(n);
+    thread_priority_queue<heap_entry> queue (std::less<heap_entry>(),
+        std::move(storage));
+    perf::region online ("online heap");
+    t0 = Clock::now();
+    std::vector<std::thread> threads;
+    std::size_t per = n / producers;
+    for (unsigned p = 0; p < producers; ++p) {
+        std::size_t first = p * per, last = p + 1 == producers ? n : first+per;
+        threads.emplace_back([&entries, &queue, &online, first, last]() {
+            perf::scope counted (online, last - first);
+            for (std::size_t i = first; i < last; ++i) queue.push(entries[i]);
+        });
+    }
+    heap_entry e;
+    std::size_t popped = 0, mismatched = 0;
+    heap_entry prev {~age_key(0), 0};
+    {
+        perf::scope counted (online, n);
+        while (popped < n) {
+            queue.wait_and_pop(e);
+            // the heap pops as soon as it can, so only the final drain is
+            // sorted
+            if (e.key > prev.key) ++mismatched;
+            prev = e;
+            ++popped;
+        }
+    }
+    for (auto&& th : threads) th.join();
+    report("online heap  ", n, seconds_since(t0));
+    std::cout << "online output out of order at " << mismatched
+        << " points (records popped before older ones arrived)" << std::endl;
+    online.report(std::cout);
+    return 0;
+}
@@ -0,0 +1,374 @@
+//
+//  container_bench.cpp
+//  thread_support
+//
+//  Microbenchmark of the thread-safe containers under producer/consumer
+//  load. Every run has P producers each pushing --ops items, and C
+//  consumers popping them between them, for each P x C up to
+//  --max-threads, each payload size, and each container variant:
+//    queue       thread_queue over std::deque
+//    queue_pool  thread_queue over pool_deque (pool_allocator.hpp)
+//    stack       thread_stack over std::deque
+//    pq          thread_priority_queue over std::vector
+//  Every push and pop call is timed. A run reports ops/s (items through
+//  per second of wall time), the p50, p99 and p99.9 latency of the calls
+//  (so the tail shows the waits for the lock, and for a consumer, the
+//  waits for an item), and its scaling efficiency: its throughput over
+//  that of the 1 x 1 run of the same variant and payload, per pair of
+//  threads ((P + C) / 2).
+//  Usage: container_bench [--ops N] [--max-threads T] [--payloads 16,64,..]
+//  [--variants queue,stack,..] [--csv file] [--json file]
+//  [--compare baseline.csv [--threshold pct]]
+//  With --compare, each run is matched with the baseline row of the same
+//  variant, payload, P and C (a CSV written by an earlier --csv), and is
+//  flagged if its ops/s fell, or its p99 rose, by more than the threshold
+//  (default 10%); the exit status is then 3 if any run was flagged.
+//  Built with -DDAVID_THREAD_INSTRUMENT (make DEFINES=...), each queue run
+//  is followed by the queue's own stats() line (instrument.hpp).
+
+//  compile this file with -std=c++17 or higher.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <array>
+#include <vector>
+#include <map>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "thread_queue.hpp"
+#include "thread_stack.hpp"
+#include "thread_priority_queue.hpp"
+#include "pool_allocator.hpp"
+
+using namespace david::thread;
+using Clock = std::chrono::steady_clock;
+
+std::uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now().time_since_epoch()).count();
+}
+
+/*  An item of @Size bytes: its sequence number, padded. The priority
+*   queue pops the lowest sequence number first. */
+template <std::size_t Size>
+struct payload {
+    std::uint64_t seq;
+    std::array<char, Size - sizeof(std::uint64_t)> pad;
+    friend bool operator<(const payload& a, const payload& b) {
+        return a.seq > b.seq;
+    }
+};
+
+/*  Every variant behind the same two calls: push(v), and a pop(v) that
+*   waits until it has an item. */
+template <class Queue>
+struct waiting_queue {
+    Queue q;
+    template <class T> void push(const T& v) { q.push(v); }
+    template <class T> void pop(T& v) { q.wait_and_pop(v); }
+    instrument::queue_stats stats() const { return q.stats(); }
+};
+
+//* thread_stack has no waiting pop; its pop throws on an empty stack.
+template <class Stack>
+struct polled_stack {
+    Stack s;
+    template <class T> void push(const T& v) { s.push(v); }
+    template <class T> void pop(T& v) {
+        for (;;) {
+            if (!s.empty()) {
+                try { s.pop(v); return; }
+                catch (empty_stack&) {}
+            }
+            std::this_thread::yield();
+        }
+    }
+    instrument::queue_stats stats() const { return {}; }
+};
+
+struct result {
+    std::string variant;
+    std::size_t payload = 0;
+    unsigned producers = 0, consumers = 0;
+    double ops_per_s = 0, p50_ns = 0, p99_ns = 0, p999_ns = 0;
+    double efficiency = 0;
+    instrument::queue_stats stats;
+};
+
+//* @return: the @q quantile of @v (which it reorders).
+double quantile(std::vector<std::uint64_t>& v, double q) {
+    if (v.empty()) return 0;
+    auto k = std::size_t(q * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return double(v[k]);
+}
+
+/*  One run: @p producers push @ops items each into a fresh Container, and
+*   @c consumers pop an equal share of them. */
+template <class Container, class Item>
+result run(unsigned p, unsigned c, std::size_t ops) {
+    Container box;
+    std::size_t total = ops * p;
+    std::vector<std::vector<std::uint64_t>> lat (c + p); // per thread
+    std::vector<std::thread> threads;
+    auto t0 = Clock::now();
+    for (unsigned i = 0; i < c; ++i) {
+        std::size_t share = total / c + (i < total % c);
+        threads.emplace_back([&box, &lat, i, share]() {
+            auto&& mine = lat[i];
+            mine.reserve(share);
+            Item v;
+            for (std::size_t n = 0; n < share; ++n) {
+                auto t = now_ns();
+                box.pop(v);
+                mine.push_back(now_ns() - t);
+            }
+        });
+    }
+    for (unsigned i = 0; i < p; ++i) {
+        threads.emplace_back([&box, &lat, i, c, ops]() {
+            auto&& mine = lat[c + i];
+            mine.reserve(ops);
+            Item v {};
+            for (std::size_t n = 0; n < ops; ++n) {
+                v.seq = i * ops + n;
+                auto t = now_ns();
+                box.push(v);
+                mine.push_back(now_ns() - t);
+            }
+        });
+    }
+    for (auto&& th : threads) th.join();
+    double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+
+    std::vector<std::uint64_t> all;
+    all.reserve(2 * total);
+    for (auto&& v : lat) all.insert(all.end(), v.begin(), v.end());
+    result r;
+    r.payload = sizeof(Item);
+    r.producers = p;
+    r.consumers = c;
+    r.ops_per_s = total / secs;
+    r.p50_ns = quantile(all, 0.5);
+    r.p99_ns = quantile(all, 0.99);
+    r.p999_ns = quantile(all, 0.999);
+    r.stats = box.stats();
+    return r;
+}
+
+template <std::size_t Size>
+result run_variant(const std::string& variant, unsigned p, unsigned c,
+    std::size_t ops)
+{
+    using item = payload<Size>;
+    result r;
+    if (variant == "queue")
+        r = run<waiting_queue<thread_queue<item>>, item>(p, c, ops);
+    else if (variant == "queue_pool")
+        r = run<waiting_queue<thread_queue<item, pool_deque<item>>>, item>(
+            p, c, ops);
+    else if (variant == "stack")
+        r = run<polled_stack<thread_stack<item>>, item>(p, c, ops);
+    else
+        r = run<waiting_queue<thread_priority_queue<item>>, item>(p, c, ops);
+    r.variant = variant;
+    return r;
+}
+
+result run_payload(std::size_t size, const std::string& variant, unsigned p,
+    unsigned c, std::size_t ops)
+{
+    switch (size) {
+        case 16:   return run_variant<16>(variant, p, c, ops);
+        case 64:   return run_variant<64>(variant, p, c, ops);
+        case 256:  return run_variant<256>(variant, p, c, ops);
+        case 512:  return run_variant<512>(variant, p, c, ops);
+        default:   return run_variant<1024>(variant, p, c, ops);
+    }
+}
+
+std::string key_of(const result& r) {
+    std::ostringstream k;
+    k << r.variant << ',' << r.payload << ',' << r.producers << ','
+        << r.consumers;
+    return k.str();
+}
+
+const char* csv_header = "variant,payload_bytes,producers,consumers,"
+    "ops_per_s,p50_ns,p99_ns,p999_ns,efficiency";
+
+void write_csv(std::ostream& o, const std::vector<result>& rs) {
+    o << csv_header << '\n' << std::fixed << std::setprecision(3);
+    for (auto&& r : rs)
+        o << key_of(r) << ',' << r.ops_per_s << ',' << r.p50_ns << ','
+            << r.p99_ns << ',' << r.p999_ns << ',' << r.efficiency << '\n';
+}
+
+void write_json(std::ostream& o, const std::vector<result>& rs) {
+    o << "[\n" << std::fixed << std::setprecision(3);
+    for (std::size_t i = 0; i < rs.size(); ++i) {
+        auto&& r = rs[i];
+        o << "  {\"variant\": \"" << r.variant << "\", \"payload_bytes\": "
+            << r.payload << ", \"producers\": " << r.producers
+            << ", \"consumers\": " << r.consumers << ", \"ops_per_s\": "
+            << r.ops_per_s << ", \"p50_ns\": " << r.p50_ns << ", \"p99_ns\": "
+            << r.p99_ns << ", \"p999_ns\": " << r.p999_ns
+            << ", \"efficiency\": " << r.efficiency << '}'
+            << (i + 1 < rs.size() ? ",\n" : "\n");
+    }
+    o << "]\n";
+}
+
+/*  Reads a CSV written by write_csv. @return: its rows by key_of(), or an
+*   empty map if it could not be read. */
+std::map<std::string, result> read_csv(const std::string& path) {
+    std::map<std::string, result> rows;
+    std::ifstream in (path);
+    std::string line;
+    if (!std::getline(in, line) || line != csv_header) return rows;
+    while (std::getline(in, line)) {
+        std::istringstream ss (line);
+        result r;
+        char comma;
+        if (!std::getline(ss, r.variant, ',')) continue;
+        if (ss >> r.payload >> comma >> r.producers >> comma >> r.consumers
+            >> comma >> r.ops_per_s >> comma >> r.p50_ns >> comma >> r.p99_ns
+            >> comma >> r.p999_ns >> comma >> r.efficiency)
+            rows[key_of(r)] = r;
+    }
+    return rows;
+}
+
+/** Compares @param rs with @param base, printing each run that regressed
+*   by more than @param threshold percent.
+*   @return: how many did */
+std::size_t compare(const std::vector<result>& rs,
+    const std::map<std::string, result>& base, double threshold)
+{
+    std::size_t flagged = 0, matched = 0;
+    double limit = threshold / 100.0;
+    for (auto&& r : rs) {
+        auto it = base.find(key_of(r));
+        if (it == base.end()) continue;
+        ++matched;
+        auto&& b = it->second;
+        double tput = r.ops_per_s / b.ops_per_s - 1;
+        double p99 = b.p99_ns > 0 ? r.p99_ns / b.p99_ns - 1 : 0;
+        if (tput >= -limit && p99 <= limit) continue;
+        ++flagged;
+        std::cout << "REGRESSION " << key_of(r) << ": ops/s "
+            << std::showpos << std::setprecision(3) << 100 * tput << "%, p99 "
+            << 100 * p99 << '%' << std::noshowpos << std::endl;
+    }
+    std::cout << matched << " runs compared with the baseline, " << flagged
+        << " regressed by more than " << std::setprecision(1) << threshold
+        << "%." << std::endl;
+    return flagged;
+}
+
+template <typename T>
+std::vector<T> parse_list(const std::string& s) {
+    std::vector<T> out;
+    std::istringstream ss (s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        std::istringstream is (item);
+        T v;
+        if (is >> v) out.push_back(v);
+    }
+    return out;
+}
+
+int usage() {
+    std::cerr << "Usage: container_bench [--ops N] [--max-threads T] "
+        "[--payloads 16,64,256,512,1024]\n  [--variants "
+        "queue,queue_pool,stack,pq] [--csv file] [--json file]\n  "
+        "[--compare baseline.csv [--threshold pct]]\n";
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t ops = 50000;
+    unsigned hwc = std::thread::hardware_concurrency();
+    unsigned max_threads = hwc > 2 ? hwc : 2;
+    std::vector<std::size_t> payloads {16, 64, 512};
+    std::vector<std::string> variants {"queue", "queue_pool", "stack", "pq"};
+    std::string csv, json, baseline;
+    double threshold = 10;
+    for (int i = 1; i < argc; ++i) {
+        std::string flag (argv[i]);
+        if (i + 1 >= argc) return usage();
+        std::string arg (argv[++i]);
+        if (flag == "--ops") ops = std::strtoull(arg.c_str(), nullptr, 10);
+        else if (flag == "--max-threads") max_threads = std::atoi(arg.c_str());
+        else if (flag == "--payloads") payloads = parse_list<std::size_t>(arg);
+        else if (flag == "--variants") variants = parse_list<std::string>(arg);
+        else if (flag == "--csv") csv = arg;
+        else if (flag == "--json") json = arg;
+        else if (flag == "--compare") baseline = arg;
+        else if (flag == "--threshold") threshold = std::atof(arg.c_str());
+        else return usage();
+    }
+    for (auto&& p : payloads)
+        if (p != 16 && p != 64 && p != 256 && p != 512 && p != 1024) {
+            std::cerr << "Payloads may be 16, 64, 256, 512 or 1024 bytes.\n";
+            return 1;
+        }
+    for (auto&& v : variants)
+        if (v != "queue" && v != "queue_pool" && v != "stack" && v != "pq") {
+            std::cerr << "Unknown variant " << v << ".\n";
+            return 1;
+        }
+    if (ops == 0 || max_threads == 0) return usage();
+    std::map<std::string, result> base;
+    if (!baseline.empty() && (base = read_csv(baseline)).empty()) {
+        std::cerr << "Could not read baseline " << baseline << ".\n";
+        return 1;
+    }
+
+    std::cout << ops << " pushes per producer, up to " << max_threads
+        << " producers and consumers." << std::endl;
+    std::cout << "variant\tbytes\tP\tC\tM ops/s\tp50 ns\tp99 ns\tp99.9 ns"
+        "\tefficiency" << std::endl << std::fixed;
+    std::vector<result> results;
+    for (auto&& v : variants)
+        for (auto&& size : payloads) {
+            double single = 0; // the 1 x 1 throughput
+            for (unsigned p = 1; p <= max_threads; p *= 2)
+                for (unsigned c = 1; c <= max_threads; c *= 2) {
+                    result r = run_payload(size, v, p, c, ops);
+                    if (p == 1 && c == 1) single = r.ops_per_s;
+                    r.efficiency = r.ops_per_s / single / ((p + c) / 2.0);
+                    std::cout << std::setprecision(0) << r.variant << '\t'
+                        << r.payload << '\t' << p << '\t' << c << '\t'
+                        << std::setprecision(3) << r.ops_per_s / 1e6 << '\t'
+                        << std::setprecision(0) << r.p50_ns << '\t'
+                        << r.p99_ns << '\t' << r.p999_ns << '\t'
+                        << std::setprecision(2) << r.efficiency << std::endl;
+                    if (r.stats.enabled)
+                        std::cout << '\t' << r.stats << std::endl;
+                    results.push_back(r);
+                }
+        }
+
+    if (!csv.empty()) {
+        std::ofstream o (csv);
+        write_csv(o, results);
+        if (!o) std::cerr << "Could not write " << csv << ".\n";
+    }
+    if (!json.empty()) {
+        std::ofstream o (json);
+        write_json(o, results);
+        if (!o) std::cerr << "Could not write " << json << ".\n";
+    }
+    if (!base.empty() && compare(results, base, threshold)) return 3;
+    return 0;
+}
@@ -0,0 +1,103 @@
+//
+//  coro_bench.cpp
+//  thread_support
+//
+//  Benchmark of coroutine pipelines (coro.hpp) over thread_queue and
+//  thread_priority_queue. Each of argv[1] pipelines (default 1,000) is a
+//  chain of argv[2] stages (default 4), each stage a coroutine that does
+//  co_await on its input queue's pop() and pushes to the next; a feeder
+//  thread pushes argv[3] items (default 100) into every pipeline, and the
+//  last stages add up what comes out. So pipelines * stages coroutines
+//  wait at once, on the shared task pool's threads and the main thread,
+//  which joins the executor. Run once over thread_queue and once over
+//  thread_priority_queue.
+
+//  compile this file with -std=c++20 or higher.
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+#include "thread_queue.hpp"
+#include "thread_priority_queue.hpp"
+#include "coro.hpp"
+
+using namespace david::thread;
+using Clock = std::chrono::steady_clock;
+
+//* Passes @n items from @in to @out, adding one to each.
+template <class Queue>
+coro::task stage(Queue& in, Queue& out, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i)
+        out.push(co_await in.pop() + 1);
+}
+
+//* Adds up the @n items of @in into @sum.
+template <class Queue>
+coro::task sink(Queue& in, std::size_t n, std::atomic<std::uint64_t>& sum) {
+    std::uint64_t mine = 0;
+    for (std::size_t i = 0; i < n; ++i) mine += co_await in.pop();
+    sum += mine;
+}
+
+template <class Queue>
+bool run(const char* name, std::size_t pipes, std::size_t stages,
+    std::size_t items)
+{
+    // pipeline p has queues [p * (stages + 1), (p + 1) * (stages + 1))
+    std::size_t width = stages + 1;
+    std::vector<std::unique_ptr<Queue>> queues;
+    for (std::size_t q = 0; q < pipes * width; ++q)
+        queues.emplace_back(new Queue);
+    std::atomic<std::uint64_t> sum {0};
+    coro::executor& ex = coro::executor::shared();
+
+    auto t0 = Clock::now();
+    for (std::size_t p = 0; p < pipes; ++p) {
+        for (std::size_t s = 0; s < stages; ++s)
+            ex.spawn(stage(*queues[p * width + s], *queues[p * width + s + 1],
+                items));
+        ex.spawn(sink(*queues[p * width + stages], items, sum));
+    }
+    std::thread feeder([&]() {
+        for (std::size_t i = 0; i < items; ++i)
+            for (std::size_t p = 0; p < pipes; ++p)
+                queues[p * width]->push(std::uint64_t(i));
+    });
+    ex.join();
+    feeder.join();
+    double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+
+    std::uint64_t want = pipes * (items * (items - 1) / 2 + items * stages);
+    std::cout << name << ": " << pipes * (stages + 1) << " coroutines, "
+        << pipes * items * stages << " hops in " << secs << " s ("
+        << pipes * items * stages / secs / 1e6 << " M hops/s)" << std::endl;
+    if (sum != want) {
+        std::cerr << name << ": sum " << sum << ", expected " << want << '\n';
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t pipes  = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000;
+    std::size_t stages = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4;
+    std::size_t items  = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 100;
+    if (!pipes || !stages || !items) {
+        std::cerr << "Usage: coro_bench [pipelines] [stages] [items]\n";
+        return 1;
+    }
+    std::cout << pipes << " pipelines of " << stages << " stages, " << items
+        << " items each, on " << task_pool::shared().concurrency()
+        << " threads." << std::endl;
+    bool ok = run<thread_queue<std::uint64_t>>("thread_queue", pipes, stages,
+        items);
+    ok = run<thread_priority_queue<std::uint64_t>>("thread_priority_queue",
+        pipes, stages, items) && ok;
+    return ok ? 0 : 2;
+}
@@ -0,0 +1,139 @@
+//
+//  list_bench.cpp
+//  thread_support
+//
+//  Benchmark of thread_list, locked hand over hand node by node, and of
+//  the lock-free sorted thread_forward_list, against a std::list behind one
+//  mutex, under a mixed load: each operation picks a random key and either
+//  looks it up (find_first_if, or contains) or updates it (removes it, then
+//  adds it back, so the list keeps its size).
+//  argv[1] is the list size (default 1,000), argv[2] the percentage of
+//  lookups (default 90), argv[3] the operations per thread (default
+//  20,000). The lists are timed at 1, 2, 4 ... up to twice the cores.
+
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include "thread_list.hpp"
+#include "thread_forward_list.hpp"
+#include "pool_allocator.hpp"
+#include "counter_rng.hpp"
+
+using namespace david::thread;
+using Clock = std::chrono::steady_clock;
+
+std::atomic<unsigned long> Found {0};
+
+//* The baseline: every operation takes the one lock for the whole walk.
+class locked_list {
+    std::list<unsigned> mData;
+    std::mutex mMut;
+    using LGuard = std::lock_guard<std::mutex>;
+public:
+    void push_front(unsigned v) { LGuard lk(mMut); mData.push_front(v); }
+    bool find(unsigned key, unsigned& out) {
+        LGuard lk(mMut);
+        auto it = std::find(mData.begin(), mData.end(), key);
+        if (it == mData.end()) return false;
+        out = *it;
+        return true;
+    }
+    void remove(unsigned key) { LGuard lk(mMut); mData.remove(key); }
+};
+
+//* Its nodes come from the pools, as each update frees one and makes one.
+struct fine_list {
+    thread_list<unsigned, pool_allocator<unsigned> > mData;
+    void push_front(unsigned v) { mData.push_front(v); }
+    bool find(unsigned key, unsigned& out) {
+        return mData.find_first_if([key](unsigned v) { return v == key; },
+            out);
+    }
+    void remove(unsigned key) {
+        mData.remove_if([key](unsigned v) { return v == key; });
+    }
+};
+
+//* Sorted, so a lookup stops at the key's place; insert() skips duplicates.
+struct lock_free_list {
+    thread_forward_list<unsigned> mData;
+    void push_front(unsigned v) { mData.insert(v); }
+    bool find(unsigned key, unsigned& out) {
+        if (!mData.contains(key)) return false;
+        out = key;
+        return true;
+    }
+    void remove(unsigned key) { mData.erase(key); }
+};
+
+/*  Runs @ops operations on each of @threads threads against @list, which
+*   holds keys [0, size). @return: the seconds taken. */
+template <class List>
+double run(List& list, unsigned threads, unsigned ops, unsigned size,
+    unsigned read_pct)
+{
+    auto t0 = Clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t)
+        workers.emplace_back([&list, t, ops, size, read_pct]() {
+            david::random::philox_stream rng (2017, t);
+            unsigned found = 0, v;
+            for (unsigned i = 0; i < ops; ++i) {
+                unsigned key = rng.bounded(size);
+                if (rng.bounded(100) < read_pct) {
+                    found += list.find(key, v);
+                } else {
+                    list.remove(key);
+                    list.push_front(key);
+                }
+            }
+            Found += found; // so the lookups can't be optimized away
+        });
+    for (auto&& th : workers) th.join();
+    return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+template <class List>
+void fill(List& list, unsigned size) {
+    for (unsigned k = size; k-- > 0; ) list.push_front(k);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned size = argc > 1 ? std::atoi(argv[1]) : 1000;
+    unsigned read_pct = argc > 2 ? std::atoi(argv[2]) : 90;
+    unsigned ops = argc > 3 ? std::atoi(argv[3]) : 20000;
+    if (size == 0 || read_pct > 100) {
+        std::cerr << "Usage: list_bench [size] [read %] [ops per thread]\n";
+        return 1;
+    }
+    unsigned hwc = std::thread::hardware_concurrency();
+    unsigned max_threads = 2 * (hwc ? hwc : 2);
+    std::cout << size << " keys, " << read_pct << "% lookups, " << ops
+        << " operations per thread." << std::endl;
+    std::cout << "threads\tstd::list+mutex (M ops/s)\tthread_list (M ops/s)"
+        "\tthread_forward_list (M ops/s)" << std::endl;
+    for (unsigned t = 1; t <= max_threads; t *= 2) {
+        locked_list coarse;
+        fine_list fine;
+        lock_free_list lock_free;
+        fill(coarse, size);
+        fill(fine, size);
+        fill(lock_free, size);
+        double total = double(t) * ops / 1e6;
+        double coarse_s = run(coarse, t, ops, size, read_pct);
+        double fine_s = run(fine, t, ops, size, read_pct);
+        double lock_free_s = run(lock_free, t, ops, size, read_pct);
+        std::cout << t << '\t' << total / coarse_s << "\t\t\t\t"
+            << total / fine_s << "\t\t\t" << total / lock_free_s
+            << std::endl;
+    }
+    return 0;
+}
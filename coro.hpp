@@ -0,0 +1,264 @@
+//
+//  coro.hpp
+//  thread_support
+//
+//*  Coroutine support for the blocking containers: a consumer that does
+//*  co_await q.pop() on a thread_queue or thread_priority_queue is parked
+//*  in the queue's intrusive list of waiters, not on a condition variable,
+//*  and the push that feeds it hands it the item directly and posts it back
+//*  to its executor. So many thousands of pipeline stages can wait at once
+//*  on a handful of threads.
+//*  An executor runs coroutines on a task_pool (parallel_algorithms.hpp):
+//*  spawn() starts a task on it, and join() runs the pool's tasks on the
+//*  calling thread as well until every task spawned on it has finished,
+//*  then rethrows the first exception any of them let out.
+//*  A coroutine must not be destroyed, nor its queue, while it waits.
+//*  Compile with -std=c++20 or higher; the queue headers only offer pop()
+//*  when coroutines are available.
+
+#ifndef coro_hpp
+#define coro_hpp
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <thread>   // std::this_thread::yield
+#include <utility>  // std::exchange
+#include "parallel_algorithms.hpp"
+
+namespace david {
+    namespace thread {
+        namespace coro {
+            class task;
+
+            /** Resumes coroutines on a task_pool. A coroutine suspended by
+            *   one of the queues comes back through post(), on whichever of
+            *   the pool's threads (or a thread in join()) gets to it. */
+            class executor {
+                task_pool& mPool;
+                std::atomic<std::size_t> mOutstanding {0};
+                std::atomic<std::uint64_t> mPosts {0};
+                std::atomic<unsigned> mJoining {0};
+                // threads in post() or finished(), which join() outwaits
+                std::atomic<unsigned> mBusy {0};
+                std::mutex mMut;
+                std::condition_variable mIdle;
+                std::exception_ptr mError;   // guarded by mMut
+                //* Convenience typedefs
+                using LGuard = std::lock_guard<std::mutex>;
+                using ULock = std::unique_lock<std::mutex>;
+
+                //* Wakes the threads in join(), if there are any.
+                void wake() {
+                    if (mJoining.load()) {
+                        LGuard lk(mMut);
+                        mIdle.notify_all();
+                    }
+                }
+
+                friend class task;
+
+                //* A spawned task is done; its frame is already freed.
+                void finished() {
+                    mBusy.fetch_add(1);
+                    if (mOutstanding.fetch_sub(1) == 1) wake();
+                    mBusy.fetch_sub(1);
+                }
+
+                void fail(std::exception_ptr e) {
+                    LGuard lk(mMut);
+                    if (!mError) mError = e;
+                }
+
+            public:
+                explicit executor(task_pool& pool = task_pool::shared())
+                : mPool(pool) {}
+                executor(const executor&) = delete;
+                executor& operator=(const executor&) = delete;
+
+                //* The executor on task_pool::shared().
+                static executor& shared() {
+                    static executor ex;
+                    return ex;
+                }
+
+                //* Queues @param h to be resumed on the pool.
+                void post(std::coroutine_handle<> h) {
+                    mBusy.fetch_add(1);
+                    mPool.push([h]() { h.resume(); });
+                    mPosts.fetch_add(1);
+                    wake();
+                    mBusy.fetch_sub(1);
+                }
+
+                //* Starts @param t on the pool.
+                void spawn(task t);
+
+                /** Runs the pool's tasks here until every task spawned on
+                *   this executor has finished, sleeping while they all wait
+                *   on other threads. Rethrows the first exception a task
+                *   let out, if any. */
+                void join() {
+                    mJoining.fetch_add(1);
+                    while (mOutstanding.load() != 0) {
+                        std::uint64_t seen = mPosts.load();
+                        if (mPool.run_one()) continue;
+                        ULock lk(mMut);
+                        mIdle.wait(lk, [&]() {
+                            return mOutstanding.load() == 0
+                                || mPosts.load() != seen;
+                        });
+                    }
+                    mJoining.fetch_sub(1);
+                    // the last task may have finished, and the executor may
+                    // be destroyed once this returns, before a post() or
+                    // finished() on another thread is quite done with it
+                    while (mBusy.load()) std::this_thread::yield();
+                    ULock lk(mMut);
+                    if (std::exception_ptr e = std::exchange(mError, nullptr))
+                        std::rethrow_exception(e);
+                }
+            };
+
+            /** A coroutine run by an executor: it starts suspended, runs
+            *   once spawned, and frees itself when it returns. Awaiting a
+            *   queue inside it resumes it on the same executor. */
+            class task {
+            public:
+                struct promise_type;
+                using handle = std::coroutine_handle<promise_type>;
+
+                struct promise_type {
+                    coro::executor* mExec = nullptr;
+
+                    task get_return_object() {
+                        return task(handle::from_promise(*this));
+                    }
+                    std::suspend_always initial_suspend() noexcept {
+                        return {};
+                    }
+
+                    //* Frees the frame, then tells the executor.
+                    struct final_awaiter {
+                        bool await_ready() noexcept { return false; }
+                        void await_suspend(handle h) noexcept {
+                            coro::executor* ex = h.promise().mExec;
+                            h.destroy();
+                            ex->finished();
+                        }
+                        void await_resume() noexcept {}
+                    };
+                    final_awaiter final_suspend() noexcept { return {}; }
+
+                    void return_void() noexcept {}
+                    void unhandled_exception() {
+                        mExec->fail(std::current_exception());
+                    }
+
+                    coro::executor& get_executor() { return *mExec; }
+                };
+
+                task(task&& t) noexcept : mHandle(std::exchange(t.mHandle, {}))
+                {}
+                task& operator=(task&&) = delete;
+                //* A task never spawned is just freed.
+                ~task() { if (mHandle) mHandle.destroy(); }
+
+            private:
+                handle mHandle;
+                explicit task(handle h) : mHandle(h) {}
+                friend class executor;
+            };
+
+            inline void executor::spawn(task t) {
+                task::handle h = std::exchange(t.mHandle, {});
+                h.promise().mExec = this;
+                mOutstanding.fetch_add(1);
+                post(h);
+            }
+
+            /** @return: the executor to resume @param h on: its promise's,
+            *   for a task, or else the shared one. */
+            template <class Promise>
+            executor& executor_of(std::coroutine_handle<Promise> h) {
+                if constexpr (requires { h.promise().get_executor(); })
+                    return h.promise().get_executor();
+                else
+                    return executor::shared();
+            }
+
+            /** A coroutine waiting on a queue for an item of type T: a node
+            *   of the queue's waiter_list. The queue moves the item into
+            *   value, under its lock, before posting handle to exec. */
+            template <typename T>
+            struct waiter {
+                waiter* next = nullptr;
+                std::coroutine_handle<> handle;
+                executor* exec = nullptr;
+                std::optional<T> value;
+
+                void resume() { exec->post(handle); }
+            };
+
+            /** The waiters of one queue, oldest first; intrusive, so
+            *   waiting allocates nothing. Guarded by the queue's lock. */
+            template <typename T>
+            class waiter_list {
+                waiter<T>* mHead = nullptr;
+                waiter<T>* mTail = nullptr;
+
+            public:
+                bool empty() const noexcept { return !mHead; }
+
+                void push(waiter<T>* w) noexcept {
+                    w->next = nullptr;
+                    (mHead ? mTail->next : mHead) = w;
+                    mTail = w;
+                }
+
+                //* @return: the oldest waiter, taken off the list.
+                waiter<T>* pop() noexcept {
+                    waiter<T>* w = mHead;
+                    mHead = w->next;
+                    if (!mHead) mTail = nullptr;
+                    return w;
+                }
+            };
+
+            /** What a queue's pop() returns: co_await it for the next item.
+            *   If the queue has one, the coroutine takes it and carries on
+            *   without suspending; otherwise it joins the queue's waiters
+            *   and is resumed, on its executor, by the push that feeds it.
+            *   Queue must offer lock(), take(std::optional<T>&) and
+            *   waiters() to its awaiter. */
+            template <class Queue, typename T>
+            class [[nodiscard]] pop_awaiter : waiter<T> {
+                Queue& mQueue;
+
+            public:
+                explicit pop_awaiter(Queue& q) : mQueue(q) {}
+
+                bool await_ready() const noexcept { return false; }
+
+                template <class Promise>
+                bool await_suspend(std::coroutine_handle<Promise> h) {
+                    auto lk = mQueue.lock();
+                    if (mQueue.take(this->value)) return false;
+                    this->handle = h;
+                    this->exec = &executor_of(h);
+                    mQueue.waiters().push(this);
+                    return true;
+                }
+
+                T await_resume() { return std::move(*this->value); }
+            };
+        }
+    }
+}
+
+#endif /* coro_hpp */
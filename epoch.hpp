@@ -0,0 +1,204 @@
+//
+//  epoch.hpp
+//  thread_support
+//
+//*  Epoch-based reclamation for lock-free structures (Fraser, "Practical
+//*  Lock-Freedom", 2004). A thread reading shared nodes holds an
+//*  epoch::guard, which pins the global epoch it saw. A node unlinked from
+//*  a structure is retired rather than deleted: it is freed once the global
+//*  epoch has moved two steps past the one it was retired in, which can
+//*  only happen after every thread that could still be looking at it has
+//*  left its guard. Readers never block and never write to shared nodes;
+//*  the cost is one atomic exchange per guard.
+
+#ifndef epoch_hpp
+#define epoch_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace david {
+    namespace thread {
+        namespace epoch {
+            //* A retired object and how to free it.
+            struct retired {
+                void* ptr;
+                void (*dispose)(void*);
+                std::uint64_t epoch;
+            };
+
+            /** The epoch, the threads taking part, and what they have
+            *   retired. There is one, domain::instance(), shared by every
+            *   structure in the process, since a thread's record is kept
+            *   in a single thread_local. */
+            class domain {
+                //* One per thread that has ever held a guard, never freed.
+                struct alignas(64) record {
+                    // (epoch << 1) | 1 while in a guard, 0 outside one
+                    std::atomic<std::uint64_t> state {0};
+                    std::atomic<bool> in_use {false};
+                    record* next = nullptr;
+                    // only touched by the thread using the record:
+                    unsigned nesting = 0;
+                    unsigned retires = 0;
+                    std::vector<retired> limbo;
+                };
+
+                std::atomic<std::uint64_t> mEpoch {1};
+                std::atomic<record*> mRecords {nullptr};
+                std::mutex mOrphanMut;              // guards mOrphans
+                std::vector<retired> mOrphans;      // from exited threads
+                //* Convenience typedefs
+                using LGuard = std::lock_guard<std::mutex>;
+
+                static constexpr unsigned advance_every = 64;
+
+                //* Frees what in @param list was retired before @param safe.
+                static void collect(std::vector<retired>& list,
+                    std::uint64_t safe)
+                {
+                    std::size_t kept = 0;
+                    for (auto&& r : list) {
+                        if (r.epoch < safe) r.dispose(r.ptr);
+                        else list[kept++] = r;
+                    }
+                    list.resize(kept);
+                }
+
+                /*  Moves the epoch on if every thread in a guard has seen
+                *   the current one. @return: the epoch now. */
+                std::uint64_t try_advance() {
+                    std::uint64_t e = mEpoch.load(std::memory_order_seq_cst);
+                    for (record* r = mRecords.load(std::memory_order_acquire);
+                        r; r = r->next)
+                    {
+                        std::uint64_t s = r->state.load(
+                            std::memory_order_seq_cst);
+                        if ((s & 1) && (s >> 1) != e) return e;
+                    }
+                    mEpoch.compare_exchange_strong(e, e + 1,
+                        std::memory_order_seq_cst);
+                    return mEpoch.load(std::memory_order_seq_cst);
+                }
+
+                void reclaim(record* rec) {
+                    std::uint64_t safe = try_advance() - 1;
+                    collect(rec->limbo, safe);
+                    std::unique_lock<std::mutex> lk(mOrphanMut,
+                        std::try_to_lock);
+                    if (lk.owns_lock()) collect(mOrphans, safe);
+                }
+
+                record* acquire() {
+                    for (record* r = mRecords.load(std::memory_order_acquire);
+                        r; r = r->next)
+                    {
+                        bool free = false;
+                        if (r->in_use.compare_exchange_strong(free, true))
+                            return r;
+                    }
+                    record* r = new record;
+                    r->in_use.store(true, std::memory_order_relaxed);
+                    r->next = mRecords.load(std::memory_order_relaxed);
+                    while (!mRecords.compare_exchange_weak(r->next, r,
+                        std::memory_order_release,
+                        std::memory_order_relaxed)) {}
+                    return r;
+                }
+
+                //* Hands a thread's record back when the thread exits.
+                void release(record* r) {
+                    if (!r->limbo.empty()) {
+                        LGuard lk(mOrphanMut);
+                        mOrphans.insert(mOrphans.end(), r->limbo.begin(),
+                            r->limbo.end());
+                        r->limbo.clear();
+                    }
+                    r->in_use.store(false, std::memory_order_release);
+                }
+
+                //* This thread's record, taken on first use.
+                record* local() {
+                    struct handle {
+                        domain* owner = nullptr;
+                        record* rec = nullptr;
+                        ~handle() { if (rec) owner->release(rec); }
+                    };
+                    static thread_local handle h;
+                    if (!h.rec) { h.owner = this; h.rec = acquire(); }
+                    return h.rec;
+                }
+
+                domain() = default;
+
+            public:
+                domain(const domain&) = delete;
+                domain& operator=(const domain&) = delete;
+
+                //* Frees everything still retired; no thread may be in a guard.
+                ~domain() {
+                    collect(mOrphans, std::uint64_t(-1));
+                    for (record* r = mRecords.load(); r; ) {
+                        collect(r->limbo, std::uint64_t(-1));
+                        record* next = r->next;
+                        delete r;
+                        r = next;
+                    }
+                }
+
+                //* The process-wide domain.
+                static domain& instance() {
+                    static domain d;
+                    return d;
+                }
+
+                //* Pins the current epoch for this thread; guards may nest.
+                void enter() {
+                    record* r = local();
+                    if (r->nesting++) return;
+                    std::uint64_t e = mEpoch.load(std::memory_order_relaxed);
+                    // a seq_cst exchange, not a plain store: the pin must be
+                    // visible before any shared node is read
+                    r->state.exchange(e << 1 | 1, std::memory_order_seq_cst);
+                }
+
+                void leave() {
+                    record* r = local();
+                    if (--r->nesting) return;
+                    r->state.store(0, std::memory_order_release);
+                }
+
+                /** Frees @param p with @param dispose once no guard that
+                *   might have seen it is left. @param p must already be
+                *   unreachable for threads entering a guard from now on. */
+                void retire(void* p, void (*dispose)(void*)) {
+                    record* r = local();
+                    r->limbo.push_back(retired {p, dispose,
+                        mEpoch.load(std::memory_order_seq_cst)});
+                    if (++r->retires % advance_every == 0) reclaim(r);
+                }
+
+                //* Deletes @param p, a T*, once it is safe to.
+                template <typename T>
+                void retire(T* p) {
+                    retire(p, [](void* q) { delete static_cast<T*>(q); });
+                }
+            };
+
+            //* RAII: this thread is in a guard for the guard's lifetime.
+            class guard {
+                domain& mDomain;
+            public:
+                guard() : mDomain(domain::instance()) { mDomain.enter(); }
+                guard(const guard&) = delete;
+                guard& operator=(const guard&) = delete;
+                ~guard() { mDomain.leave(); }
+            };
+        }
+    }
+}
+
+#endif /* epoch_hpp */
@@ -0,0 +1,119 @@
+//
+//  equation_convert.cpp
+//  thread_support
+//
+//  Converts equations, or solutions, between the text format written by
+//  generate_math and solve_equations ("id: a op b", optionally followed by
+//  " = result") and the binary equation file format of equation_file.hpp.
+//  Usage: equation_convert input output. The direction is taken from the
+//  input: a binary file becomes text, anything else becomes binary. Lines
+//  that are not a single "a op b" (garbled, or compound expressions) have
+//  no binary form and are skipped, with a count on stderr.
+
+//  compile this file with -std=c++17 or higher.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cmath>       // NAN
+#include "mapped_file.hpp"
+#include "equation_file.hpp"
+#include "equation_kernel.hpp"
+
+struct text_columns {
+    std::vector<std::uint32_t> ids;
+    std::vector<double>        a, b, results;
+    std::vector<std::uint8_t>  op;
+    bool any_result = false;
+};
+
+/*  Parses one "id: a op b [= result]" line at @p, advancing @p to the next
+*   line either way. Lines are read as solve_equations reads them.
+*   @return: whether the line was a single equation. */
+bool parse_line(const char*& p, const char* last, text_columns& cols) {
+    using namespace david::io;
+    const char* line = p;
+    p = next_line(p, last);
+    std::uint32_t id; double a, b, r = NAN;
+    if (!parse_int(line, p, id)) return false;
+    line = skip_blanks(line, p);
+    if (line == p || *line != ':' || !parse_double(++line, p, a))
+        return false;
+    line = skip_blanks(line, p);
+    if (line == p) return false;
+    auto op = david::math::to_op_code(*line++);
+    if (op == david::math::op_none || !parse_double(line, p, b)) return false;
+    line = skip_blanks(line, p);
+    bool solved = line != p && *line == '=' && parse_double(++line, p, r);
+    // a compound expression; anything else after b is ignored, as it is by
+    // solve_equations
+    if (!solved && line != p && david::math::to_op_code(*line)
+        != david::math::op_none) return false;
+    cols.ids.push_back(id);
+    cols.a.push_back(a); cols.op.push_back(op); cols.b.push_back(b);
+    cols.results.push_back(r);
+    cols.any_result |= solved;
+    return true;
+}
+
+int to_binary(const david::io::mapped_file& input, std::ofstream& output) {
+    text_columns cols;
+    std::size_t skipped = 0;
+    for (const char* p = input.begin(); p != input.end(); ) {
+        const char* line = p;
+        if (parse_line(p, input.end(), cols)) continue;
+        line = david::io::skip_blanks(line, p);
+        if (line != p && *line != '\n') ++skipped; // not just a blank line
+    }
+    if (skipped)
+        std::cerr << skipped << " lines were not single equations and were "
+            "skipped.\n";
+    if (!david::io::write_equation_file(output, cols.ids.size(),
+        cols.ids.data(), cols.a.data(), cols.op.data(), cols.b.data(),
+        cols.any_result ? cols.results.data() : nullptr)) {
+        std::cerr << "Could not write the output file.\n";
+        return -3;
+    }
+    return 0;
+}
+
+int to_text(david::io::mapped_file input, std::ofstream& output) {
+    david::io::equation_file eqns;
+    try { eqns = david::io::equation_file(std::move(input)); }
+    catch (david::io::format_error& fe) {
+        std::cerr << fe.what() << std::endl;
+        return -1;
+    }
+    auto ids = eqns.ids(); auto op = eqns.op();
+    auto a = eqns.a(); auto b = eqns.b(); auto r = eqns.results();
+    for (std::size_t i = 0; i < eqns.size(); ++i) {
+        output << ids[i] << ": " << a[i] << ' '
+            << david::math::to_op_char(op[i]) << ' ' << b[i];
+        if (r) output << " = " << r[i];
+        output << '\n';
+    }
+    return output ? 0 : -3;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3) {
+        std::cerr << "Usage: equation_convert input output\n";
+        return 1;
+    }
+    david::io::mapped_file input;
+    try { input = david::io::mapped_file(argv[1]); }
+    catch (std::system_error& se) {
+        std::cerr << se.what() << std::endl;
+        return -1;
+    }
+    bool binary = david::io::is_equation_file(input);
+    std::ofstream output (argv[2], binary ? std::ios::out : std::ios::binary);
+    if (!output.is_open()) {
+        std::cerr << "Could not open output file.\n";
+        return -2;
+    }
+    return binary ? to_text(std::move(input), output)
+        : to_binary(input, output);
+}
@@ -0,0 +1,194 @@
+//
+//  equation_file.hpp
+//  thread_support
+//
+//*  A versioned binary columnar format for equations and their solutions,
+//*  so that generate_math, solve_equations and equation_convert can pass
+//*  doubles around without formatting and parsing them as text.
+//*  Layout (native little-endian, every column 64-byte aligned):
+//*      header   64 bytes, see equation_file_header
+//*      id[]     uint32 per equation
+//*      a[]      double
+//*      b[]      double
+//*      op[]     uint8, a david::math::op_code (add, sub, mul or div)
+//*      result[] double, only when flags has has_results
+//*  The header records each column's offset, so readers never assume the
+//*  order above. equation_file maps a file and hands out pointers straight
+//*  into the mapping; nothing is copied.
+//*  Compile with -std=c++17 or higher.
+
+#ifndef equation_file_hpp
+#define equation_file_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>     // std::memcmp, std::memcpy
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include "mapped_file.hpp"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "equation files are little-endian; add byte swapping for this target"
+#endif
+
+namespace david {
+    namespace io {
+        constexpr char          equation_file_magic[8] = "DEQNCOL";
+        constexpr std::uint32_t equation_file_version  = 1;
+        constexpr std::size_t   equation_file_align    = 64;
+        //* Op bytes are below this: david::math::op_none and up are invalid.
+        constexpr std::uint8_t  equation_file_op_limit = 4;
+
+        enum equation_file_flags : std::uint32_t { has_results = 1 };
+
+        struct equation_file_header {
+            char          magic[8];     // equation_file_magic
+            std::uint32_t version;      // equation_file_version
+            std::uint32_t flags;        // equation_file_flags
+            std::uint64_t count;        // equations in every column
+            std::uint64_t id_offset,    // byte offsets from the file's start
+                          a_offset,
+                          b_offset,
+                          op_offset,
+                          result_offset; // 0 without has_results
+        };
+        static_assert(sizeof(equation_file_header) == 64,
+            "the header is one cache line");
+
+        //* Thrown when a file is not a well-formed equation file.
+        struct format_error : public std::runtime_error {
+            using std::runtime_error::runtime_error;
+        };
+
+        //* @return: whether @param file starts with the equation file magic.
+        inline bool is_equation_file(const mapped_file& file) noexcept {
+            return file.size() >= sizeof(equation_file_header)
+                && std::memcmp(file.begin(), equation_file_magic,
+                    sizeof equation_file_magic) == 0;
+        }
+
+        /** A mapped equation file. The column accessors point into the
+        *   mapping, which lives as long as this object. */
+        class equation_file {
+            mapped_file mFile;
+            equation_file_header mHeader {};
+
+            template <typename T>
+            const T* column(std::uint64_t offset) const noexcept {
+                return reinterpret_cast<const T*>(mFile.begin() + offset);
+            }
+
+            void check_column(std::uint64_t offset, std::size_t width,
+                const char* name) const
+            {
+                std::uint64_t bytes = mHeader.count * width;
+                if (offset % equation_file_align != 0
+                    || offset < sizeof(equation_file_header)
+                    || offset > mFile.size() || bytes > mFile.size() - offset)
+                    throw format_error(std::string("bad ") + name + " column");
+            }
+
+            //* Rejects an op byte that is not add, sub, mul or div.
+            void check_ops() const {
+                const std::uint8_t* op = this->op();
+                for (std::uint64_t i = 0; i < mHeader.count; ++i)
+                    if (op[i] >= equation_file_op_limit)
+                        throw format_error("bad op " + std::to_string(op[i])
+                            + " at equation " + std::to_string(i));
+            }
+
+        public:
+            equation_file() = default;
+
+            /** Takes over @param file, checking its header and columns.
+            *   @throw format_error if it is not a version we can read, or
+        *   an op is out of range. */
+            explicit equation_file(mapped_file file) : mFile(std::move(file)) {
+                if (!is_equation_file(mFile))
+                    throw format_error("not an equation file");
+                std::memcpy(&mHeader, mFile.begin(), sizeof mHeader);
+                if (mHeader.version != equation_file_version)
+                    throw format_error("unsupported equation file version "
+                        + std::to_string(mHeader.version));
+                if (mHeader.count > std::uint64_t(UINT32_MAX))
+                    throw format_error("too many equations");
+                check_column(mHeader.id_offset, sizeof(std::uint32_t), "id");
+                check_column(mHeader.a_offset,  sizeof(double), "a");
+                check_column(mHeader.b_offset,  sizeof(double), "b");
+                check_column(mHeader.op_offset, sizeof(std::uint8_t), "op");
+                check_ops();
+                if (has_results())
+                    check_column(mHeader.result_offset, sizeof(double),
+                        "result");
+            }
+
+            std::size_t size() const noexcept { return mHeader.count; }
+            bool has_results() const noexcept {
+                return (mHeader.flags & io::has_results) != 0;
+            }
+
+            const std::uint32_t* ids() const noexcept {
+                return column<std::uint32_t>(mHeader.id_offset);
+            }
+            const double* a() const noexcept {
+                return column<double>(mHeader.a_offset);
+            }
+            const double* b() const noexcept {
+                return column<double>(mHeader.b_offset);
+            }
+            const std::uint8_t* op() const noexcept {
+                return column<std::uint8_t>(mHeader.op_offset);
+            }
+            //* @return: the result column, or nullptr if there is none.
+            const double* results() const noexcept {
+                return has_results() ? column<double>(mHeader.result_offset)
+                    : nullptr;
+            }
+        };
+
+        /** Writes @param n equations as an equation file to @param o, with a
+        *   result column if @param results is given. Every op must be an
+        *   op_code other than op_none.
+        *   @return: whether the stream is still good. */
+        inline bool write_equation_file(std::ostream& o, std::size_t n,
+            const std::uint32_t* ids, const double* a, const std::uint8_t* op,
+            const double* b, const double* results = nullptr)
+        {
+            auto round_up = [](std::uint64_t x) {
+                return (x + equation_file_align - 1) / equation_file_align
+                    * equation_file_align;
+            };
+            equation_file_header h {};
+            std::memcpy(h.magic, equation_file_magic, sizeof h.magic);
+            h.version = equation_file_version;
+            h.flags   = results ? std::uint32_t(has_results) : 0;
+            h.count   = n;
+            h.id_offset = sizeof h;
+            h.a_offset  = round_up(h.id_offset + n * sizeof *ids);
+            h.b_offset  = round_up(h.a_offset  + n * sizeof *a);
+            h.op_offset = round_up(h.b_offset  + n * sizeof *b);
+            if (results)
+                h.result_offset = round_up(h.op_offset + n * sizeof *op);
+
+            std::uint64_t at = 0;
+            static const char zeros[equation_file_align] = {};
+            auto put = [&o, &at](std::uint64_t offset, const void* p,
+                std::size_t bytes)
+            {
+                o.write(zeros, offset - at); // padding up to the column
+                o.write(static_cast<const char*>(p), bytes);
+                at = offset + bytes;
+            };
+            put(0, &h, sizeof h);
+            put(h.id_offset, ids, n * sizeof *ids);
+            put(h.a_offset,  a,   n * sizeof *a);
+            put(h.b_offset,  b,   n * sizeof *b);
+            put(h.op_offset, op,  n * sizeof *op);
+            if (results) put(h.result_offset, results, n * sizeof *results);
+            return bool(o);
+        }
+    }
+}
+
+#endif /* equation_file_hpp */
@@ -0,0 +1,225 @@
+//
+//  equation_kernel.hpp
+//  thread_support
+//
+//*  Structure-of-arrays storage and vectorized evaluation for the binary
+//*  equations solved by solve_equations.cpp. Every lane computes all four
+//*  results and keeps the one its op code asks for, so there is no branch
+//*  per equation. AVX-512 and AVX2 kernels are chosen at run time, with a
+//*  scalar fallback; all three give bit-identical results (IEEE-754 add,
+//*  subtract, multiply and divide are exact-rounded in every unit, and 0 / 0
+//*  is the same default -nan).
+//*  Set EQUATION_KERNEL=scalar|avx2|avx512 to force one (if supported).
+//*  Compile with -std=c++17 or higher, with GCC or Clang on x86-64.
+
+#ifndef equation_kernel_hpp
+#define equation_kernel_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>   // std::getenv
+#include <cstring>   // std::strcmp
+#include <new>       // std::align_val_t
+#include <vector>
+#include <immintrin.h>
+
+namespace david {
+    namespace math {
+        //* Op codes, in the order of operation::op's '+', '-', '*', '/'.
+        enum op_code : std::uint8_t { op_add, op_sub, op_mul, op_div, op_none };
+
+        constexpr op_code to_op_code(char op) noexcept {
+            return op == '+' ? op_add : op == '-' ? op_sub
+                 : op == '*' ? op_mul : op == '/' ? op_div : op_none;
+        }
+
+        constexpr char to_op_char(std::uint8_t code) noexcept {
+            return code == op_add ? '+' : code == op_sub ? '-'
+                 : code == op_mul ? '*' : code == op_div ? '/' : '?';
+        }
+
+        /** Minimal allocator handing out Align-byte aligned storage, so
+        *   kernels start every column on a cache line. */
+        template <typename T, std::size_t Align = 64>
+        struct aligned_allocator {
+            using value_type = T;
+            template <typename U> struct rebind {
+                using other = aligned_allocator<U, Align>;
+            };
+            aligned_allocator() noexcept = default;
+            template <typename U>
+            aligned_allocator(const aligned_allocator<U, Align>&) noexcept {}
+
+            T* allocate(std::size_t n) {
+                return static_cast<T*>(::operator new(n * sizeof(T),
+                    std::align_val_t(Align)));
+            }
+            void deallocate(T* p, std::size_t) noexcept {
+                ::operator delete(p, std::align_val_t(Align));
+            }
+            template <typename U> bool operator==(
+                const aligned_allocator<U, Align>&) const noexcept {
+                return true;
+            }
+            template <typename U> bool operator!=(
+                const aligned_allocator<U, Align>&) const noexcept {
+                return false;
+            }
+        };
+
+        template <typename T>
+        using aligned_vector = std::vector<T, aligned_allocator<T>>;
+
+        //* Read-only columns owned elsewhere, e.g. a mapped equation file.
+        struct column_view {
+            const double*       a;
+            const std::uint8_t* op;
+            const double*       b;
+        };
+
+        //* Equations as three parallel columns: a[i] op[i] b[i].
+        struct equation_columns {
+            aligned_vector<double>       a, b;
+            aligned_vector<std::uint8_t> op;
+
+            void reserve(std::size_t n) {
+                a.reserve(n); b.reserve(n); op.reserve(n);
+            }
+            void push_back(double x, char o, double y) {
+                a.push_back(x); op.push_back(to_op_code(o)); b.push_back(y);
+            }
+            std::size_t size() const noexcept { return a.size(); }
+            column_view view() const noexcept {
+                return column_view {a.data(), op.data(), b.data()};
+            }
+        };
+
+        //* Signature shared by every kernel: out[i] = a[i] op[i] b[i].
+        using kernel_fn = void (*)(const double* a, const std::uint8_t* op,
+            const double* b, double* out, std::size_t n);
+
+        inline double evaluate_one(double a, std::uint8_t op, double b)
+            noexcept
+        {
+            switch (op) {
+                case op_add: return a + b;
+                case op_sub: return a - b;
+                case op_mul: return a * b;
+                case op_div: return a / b;
+                default:     return 0.0;
+            }
+        }
+
+        inline void evaluate_scalar(const double* a, const std::uint8_t* op,
+            const double* b, double* out, std::size_t n) noexcept
+        {
+            for (std::size_t i = 0; i < n; ++i)
+                out[i] = evaluate_one(a[i], op[i], b[i]);
+        }
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define DAVID_EQUATION_KERNEL_X86 1
+        __attribute__((target("avx2")))
+        inline void evaluate_avx2(const double* a, const std::uint8_t* op,
+            const double* b, double* out, std::size_t n) noexcept
+        {
+            const __m256i add = _mm256_set1_epi64x(op_add);
+            const __m256i sub = _mm256_set1_epi64x(op_sub);
+            const __m256i mul = _mm256_set1_epi64x(op_mul);
+            const __m256i div = _mm256_set1_epi64x(op_div);
+            std::size_t i = 0;
+            for (; i + 4 <= n; i += 4) {
+                __m256d va = _mm256_loadu_pd(a + i);
+                __m256d vb = _mm256_loadu_pd(b + i);
+                std::int32_t ops;
+                __builtin_memcpy(&ops, op + i, sizeof ops);
+                __m256i code = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(ops));
+                __m256d r = _mm256_setzero_pd();
+                r = _mm256_blendv_pd(r, _mm256_add_pd(va, vb),
+                    _mm256_castsi256_pd(_mm256_cmpeq_epi64(code, add)));
+                r = _mm256_blendv_pd(r, _mm256_sub_pd(va, vb),
+                    _mm256_castsi256_pd(_mm256_cmpeq_epi64(code, sub)));
+                r = _mm256_blendv_pd(r, _mm256_mul_pd(va, vb),
+                    _mm256_castsi256_pd(_mm256_cmpeq_epi64(code, mul)));
+                r = _mm256_blendv_pd(r, _mm256_div_pd(va, vb),
+                    _mm256_castsi256_pd(_mm256_cmpeq_epi64(code, div)));
+                _mm256_storeu_pd(out + i, r);
+            }
+            evaluate_scalar(a + i, op + i, b + i, out + i, n - i);
+        }
+
+        __attribute__((target("avx512f")))
+        inline void evaluate_avx512(const double* a, const std::uint8_t* op,
+            const double* b, double* out, std::size_t n) noexcept
+        {
+            const __m512i add = _mm512_set1_epi64(op_add);
+            const __m512i sub = _mm512_set1_epi64(op_sub);
+            const __m512i mul = _mm512_set1_epi64(op_mul);
+            const __m512i div = _mm512_set1_epi64(op_div);
+            std::size_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                __m512d va = _mm512_loadu_pd(a + i);
+                __m512d vb = _mm512_loadu_pd(b + i);
+                std::int64_t ops;
+                __builtin_memcpy(&ops, op + i, sizeof ops);
+                __m512i code = _mm512_maskz_cvtepu8_epi64(0xFF,
+                    _mm_cvtsi64_si128(ops));
+                // each masked op only touches the lanes that asked for it
+                __m512d r = _mm512_setzero_pd();
+                r = _mm512_mask_add_pd(r, _mm512_cmpeq_epi64_mask(code, add),
+                    va, vb);
+                r = _mm512_mask_sub_pd(r, _mm512_cmpeq_epi64_mask(code, sub),
+                    va, vb);
+                r = _mm512_mask_mul_pd(r, _mm512_cmpeq_epi64_mask(code, mul),
+                    va, vb);
+                r = _mm512_mask_div_pd(r, _mm512_cmpeq_epi64_mask(code, div),
+                    va, vb);
+                _mm512_storeu_pd(out + i, r);
+            }
+            evaluate_scalar(a + i, op + i, b + i, out + i, n - i);
+        }
+#endif
+
+        /** @return: the best kernel this CPU supports, unless the
+        *   EQUATION_KERNEL environment variable names a supported one.
+        *   @param name is set to the chosen kernel's name, if given. */
+        inline kernel_fn select_kernel(const char** name = nullptr) {
+            const char* want = std::getenv("EQUATION_KERNEL");
+            auto wants = [want](const char* k) {
+                return !want || std::strcmp(want, k) == 0;
+            };
+            kernel_fn fn = evaluate_scalar;
+            const char* chosen = "scalar";
+#ifdef DAVID_EQUATION_KERNEL_X86
+            if (!(want && std::strcmp(want, "scalar") == 0)) {
+                if (wants("avx512") && __builtin_cpu_supports("avx512f")) {
+                    fn = evaluate_avx512; chosen = "avx512";
+                } else if (wants("avx2") && __builtin_cpu_supports("avx2")) {
+                    fn = evaluate_avx2; chosen = "avx2";
+                }
+            }
+#endif
+            if (name) *name = chosen;
+            return fn;
+        }
+
+        /** Evaluates equations [first, last) of @param eqns into
+        *   out[first, last), with the kernel picked once per process. */
+        inline void evaluate(column_view eqns, double* out,
+            std::size_t first, std::size_t last)
+        {
+            static const kernel_fn kernel = select_kernel();
+            if (first < last)
+                kernel(eqns.a + first, eqns.op + first, eqns.b + first,
+                    out + first, last - first);
+        }
+
+        inline void evaluate(const equation_columns& eqns, double* out,
+            std::size_t first, std::size_t last)
+        {
+            evaluate(eqns.view(), out, first, last);
+        }
+    }
+}
+
+#endif /* equation_kernel_hpp */
@@ -0,0 +1,417 @@
+//
+//  expression.hpp
+//  thread_support
+//
+//*  Arithmetic expressions with precedence and parentheses, for equations
+//*  longer than solve_equations.cpp's single "a op b".
+//*  parse() builds an AST; compile() turns it into a compact register
+//*  bytecode, folding constant subexpressions as it goes; and a program
+//*  runs over many lanes (one expression instance per lane) at once, so
+//*  each instruction is dispatched once per block of lanes and its inner
+//*  loop is a plain array loop the compiler vectorizes.
+//*  Every operation is the same IEEE-754 double operation, in the same
+//*  order, as evaluating the expression directly, so results are
+//*  bit-identical to a scalar evaluation.
+//*  Compile with -std=c++17 or higher.
+
+#ifndef expression_hpp
+#define expression_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>     // std::memcpy
+#include <charconv>    // std::from_chars
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>   // std::min, std::max
+#include "equation_kernel.hpp" // aligned_vector
+
+namespace david {
+    namespace math {
+        //* Thrown by parse() on malformed input.
+        struct expression_error : public std::runtime_error {
+            using std::runtime_error::runtime_error;
+        };
+
+        enum class node_kind : std::uint8_t {
+            literal, variable, negate, add, subtract, multiply, divide
+        };
+
+        struct ast_node {
+            node_kind kind;
+            double    value = 0.0;  // literal
+            unsigned  slot  = 0;    // variable: index into ast::variables
+            int       lhs = -1, rhs = -1;
+        };
+
+        /** The deepest an expression may nest, in parentheses and signs or
+        *   in its tree; parse() rejects anything deeper, so neither it nor
+        *   compile() can run out of stack. */
+        constexpr unsigned max_expression_depth = 256;
+
+        //* A parsed expression: nodes in a flat array, root last.
+        struct ast {
+            std::vector<ast_node>    nodes;
+            std::vector<std::string> variables;
+            int root = -1;
+        };
+
+        namespace detail {
+            class parser {
+                const char* p;
+                const char* last;
+                ast& out;
+                unsigned nesting = 0;       // unary() calls under way
+                std::vector<unsigned> depth; // per node: height of its tree
+
+                //* Counts one level of recursion for as long as it lives.
+                struct nest {
+                    unsigned& level;
+                    explicit nest(unsigned& l) : level(l) {
+                        if (++level > max_expression_depth)
+                            throw expression_error("expression too deep");
+                    }
+                    ~nest() { --level; }
+                };
+
+                void skip() {
+                    while (p != last && (*p == ' ' || *p == '\t' || *p == '\r'))
+                        ++p;
+                }
+                bool accept(char c) {
+                    skip();
+                    if (p != last && *p == c) { ++p; return true; }
+                    return false;
+                }
+                int add(ast_node n) {
+                    unsigned d = 1 + std::max(n.lhs < 0 ? 0 : depth[n.lhs],
+                        n.rhs < 0 ? 0 : depth[n.rhs]);
+                    if (d > max_expression_depth)
+                        throw expression_error("expression too deep");
+                    depth.push_back(d);
+                    out.nodes.push_back(n);
+                    return int(out.nodes.size()) - 1;
+                }
+                int binary(node_kind k, int l, int r) {
+                    ast_node n {k}; n.lhs = l; n.rhs = r;
+                    return add(n);
+                }
+
+                // expr := term (('+' | '-') term)*
+                int expr() {
+                    int l = term();
+                    for (;;) {
+                        if (accept('+'))      l = binary(node_kind::add, l, term());
+                        else if (accept('-')) l = binary(node_kind::subtract, l,
+                            term());
+                        else return l;
+                    }
+                }
+                // term := unary (('*' | '/') unary)*
+                int term() {
+                    int l = unary();
+                    for (;;) {
+                        if (accept('*'))      l = binary(node_kind::multiply, l,
+                            unary());
+                        else if (accept('/')) l = binary(node_kind::divide, l,
+                            unary());
+                        else return l;
+                    }
+                }
+                // unary := ('-' | '+') unary | primary
+                int unary() {
+                    nest level (nesting);
+                    if (accept('+')) return unary();
+                    if (accept('-')) {
+                        int x = unary();
+                        ast_node& n = out.nodes[x];
+                        // a signed literal is one literal; negation is exact
+                        if (n.kind == node_kind::literal) {
+                            n.value = -n.value;
+                            return x;
+                        }
+                        ast_node neg {node_kind::negate}; neg.lhs = x;
+                        return add(neg);
+                    }
+                    return primary();
+                }
+                // primary := number | identifier | '(' expr ')'
+                int primary() {
+                    skip();
+                    if (p == last) throw expression_error("unexpected end");
+                    if (*p == '(') {
+                        ++p;
+                        int x = expr();
+                        if (!accept(')')) throw expression_error("expected )");
+                        return x;
+                    }
+                    if (is_ident_start(*p)) {
+                        const char* w = p;
+                        while (p != last && (is_ident_start(*p)
+                            || (*p >= '0' && *p <= '9'))) ++p;
+                        std::string name (w, p);
+                        ast_node n {node_kind::variable};
+                        auto it = std::find(out.variables.begin(),
+                            out.variables.end(), name);
+                        n.slot = unsigned(it - out.variables.begin());
+                        if (it == out.variables.end())
+                            out.variables.push_back(name);
+                        return add(n);
+                    }
+                    ast_node n {node_kind::literal};
+                    auto res = std::from_chars(p, last, n.value);
+                    if (res.ec != std::errc())
+                        throw expression_error("expected a number");
+                    p = res.ptr;
+                    return add(n);
+                }
+                static bool is_ident_start(char c) {
+                    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+                        || c == '_';
+                }
+
+            public:
+                parser(std::string_view text, ast& tree)
+                : p(text.data()), last(text.data() + text.size()), out(tree) {}
+
+                void run() {
+                    out.root = expr();
+                    skip();
+                    if (p != last && *p != '\n')
+                        throw expression_error("unexpected character");
+                }
+            };
+        }
+
+        /** Parses @param text (up to the end or a newline).
+        *   @throw expression_error if it is not a well-formed expression, or
+        *   nests deeper than max_expression_depth. */
+        inline ast parse(std::string_view text) {
+            ast tree;
+            detail::parser(text, tree).run();
+            return tree;
+        }
+
+        enum class opcode : std::uint8_t {
+            load_const, load_input, negate, add, subtract, multiply, divide
+        };
+
+        //* r[dst] = r[a] op r[b]; loads read constants[a] or input a.
+        struct instruction {
+            opcode        op;
+            std::uint8_t  dst, a, b;
+        };
+
+        /** Compiled bytecode. Input slots 0..variables.size()-1 are the
+        *   named variables; the next `hoisted` slots are literals lifted out
+        *   of the code by compile(), so that expressions differing only in
+        *   their numbers share one program and can run in the same lanes. */
+        struct program {
+            std::vector<instruction> code;
+            std::vector<double>      constants;
+            std::vector<std::string> variables;
+            unsigned hoisted   = 0;
+            unsigned registers = 0;
+
+            static constexpr std::size_t block_lanes = 256;
+
+            std::size_t inputs() const noexcept {
+                return variables.size() + hoisted;
+            }
+
+            /** @return: a key equal for two programs iff they compute the
+            *   same function of their inputs. */
+            std::string shape() const {
+                std::string key;
+                key.append(reinterpret_cast<const char*>(code.data()),
+                    code.size() * sizeof(instruction));
+                key.append(reinterpret_cast<const char*>(constants.data()),
+                    constants.size() * sizeof(double));
+                for (auto&& v : variables) { key += '\0'; key += v; }
+                return key;
+            }
+
+            static void binary(opcode op, double* d, const double* x,
+                const double* y, std::size_t n) noexcept
+            {
+                // d may alias x (r = r op r+1), so no __restrict
+                switch (op) {
+                case opcode::add:
+                    for (std::size_t i = 0; i < n; ++i) d[i] = x[i] + y[i];
+                    break;
+                case opcode::subtract:
+                    for (std::size_t i = 0; i < n; ++i) d[i] = x[i] - y[i];
+                    break;
+                case opcode::multiply:
+                    for (std::size_t i = 0; i < n; ++i) d[i] = x[i] * y[i];
+                    break;
+                case opcode::divide:
+                    for (std::size_t i = 0; i < n; ++i) d[i] = x[i] / y[i];
+                    break;
+                default: break;
+                }
+            }
+
+            /** Evaluates @param lanes instances: lane i reads in[s][i] for
+            *   every input slot s, and its result goes to out[i]. Each
+            *   instruction runs over a block of lanes before the next. */
+            void run(std::size_t lanes, const double* const* in,
+                double* out) const
+            {
+                aligned_vector<double> regs (std::max(registers, 1u)
+                    * block_lanes);
+                for (std::size_t base = 0; base < lanes; base += block_lanes) {
+                    std::size_t n = std::min(block_lanes, lanes - base);
+                    for (const instruction& ins : code) {
+                        double* d = &regs[ins.dst * block_lanes];
+                        switch (ins.op) {
+                        case opcode::load_const: {
+                            double c = constants[ins.a];
+                            for (std::size_t i = 0; i < n; ++i) d[i] = c;
+                            break;
+                        }
+                        case opcode::load_input: {
+                            const double* src = in[ins.a] + base;
+                            for (std::size_t i = 0; i < n; ++i) d[i] = src[i];
+                            break;
+                        }
+                        case opcode::negate: {
+                            const double* x = &regs[ins.a * block_lanes];
+                            for (std::size_t i = 0; i < n; ++i) d[i] = -x[i];
+                            break;
+                        }
+                        default:
+                            binary(ins.op, d, &regs[ins.a * block_lanes],
+                                &regs[ins.b * block_lanes], n);
+                        }
+                    }
+                    std::memcpy(out + base, regs.data(), n * sizeof(double));
+                }
+            }
+        };
+
+        //* A compiled expression, with the values of its hoisted literals.
+        struct compiled {
+            program             prog;
+            std::vector<double> literals;
+        };
+
+        namespace detail {
+            class compiler {
+                const ast& tree;
+                bool hoist;
+                compiled& out;
+                std::vector<char> constant; // per node: no variables below it
+
+                static double apply(node_kind k, double x, double y) {
+                    switch (k) {
+                        case node_kind::negate:   return -x;
+                        case node_kind::add:      return x + y;
+                        case node_kind::subtract: return x - y;
+                        case node_kind::multiply: return x * y;
+                        case node_kind::divide:   return x / y;
+                        default:                  return 0.0;
+                    }
+                }
+
+                double fold(int i) const {
+                    const ast_node& n = tree.nodes[i];
+                    if (n.kind == node_kind::literal) return n.value;
+                    return apply(n.kind, fold(n.lhs),
+                        n.rhs < 0 ? 0.0 : fold(n.rhs));
+                }
+
+                bool mark(int i) {
+                    const ast_node& n = tree.nodes[i];
+                    bool c;
+                    switch (n.kind) {
+                        case node_kind::literal:  c = true;  break;
+                        case node_kind::variable: c = false;  break;
+                        case node_kind::negate:   c = mark(n.lhs); break;
+                        default: {
+                            bool l = mark(n.lhs), r = mark(n.rhs);
+                            c = l && r;
+                        }
+                    }
+                    constant[i] = c;
+                    return c;
+                }
+
+                unsigned reg(unsigned r) {
+                    if (r > 255) throw expression_error("expression too deep");
+                    out.prog.registers = std::max(out.prog.registers, r + 1);
+                    return r;
+                }
+
+                void emit(opcode op, unsigned dst, unsigned a, unsigned b = 0) {
+                    out.prog.code.push_back(instruction {op,
+                        std::uint8_t(dst), std::uint8_t(a), std::uint8_t(b)});
+                }
+
+                // evaluates node i into register r, using r and above
+                void gen(int i, unsigned r) {
+                    const ast_node& n = tree.nodes[i];
+                    reg(r);
+                    if (constant[i] && hoist) { // folded, then hoisted
+                        unsigned slot = unsigned(tree.variables.size()
+                            + out.literals.size());
+                        if (slot > 255) throw expression_error("too many inputs");
+                        out.literals.push_back(fold(i));
+                        emit(opcode::load_input, r, slot);
+                        return;
+                    }
+                    if (constant[i]) {
+                        out.prog.constants.push_back(fold(i));
+                        unsigned c = unsigned(out.prog.constants.size() - 1);
+                        if (c > 255) throw expression_error("too many constants");
+                        emit(opcode::load_const, r, c);
+                        return;
+                    }
+                    switch (n.kind) {
+                    case node_kind::variable:
+                        emit(opcode::load_input, r, n.slot);
+                        return;
+                    case node_kind::negate:
+                        gen(n.lhs, r);
+                        emit(opcode::negate, r, r);
+                        return;
+                    default:
+                        gen(n.lhs, r);
+                        gen(n.rhs, reg(r + 1));
+                        emit(n.kind == node_kind::add ? opcode::add
+                            : n.kind == node_kind::subtract ? opcode::subtract
+                            : n.kind == node_kind::multiply ? opcode::multiply
+                            : opcode::divide, r, r, r + 1);
+                    }
+                }
+
+            public:
+                compiler(const ast& t, bool h, compiled& c)
+                : tree(t), hoist(h), out(c), constant(t.nodes.size()) {}
+
+                void run() {
+                    if (tree.root < 0) throw expression_error("empty");
+                    mark(tree.root);
+                    gen(tree.root, 0);
+                    out.prog.variables = tree.variables;
+                    out.prog.hoisted = unsigned(out.literals.size());
+                }
+            };
+        }
+
+        /** Compiles @param tree. Subexpressions with no variables are
+        *   folded to a single constant. With @param hoist_literals, each
+        *   folded value instead becomes an input slot, whose value for this
+        *   expression is kept in compiled::literals; use it to batch many
+        *   expressions of the same shape into one program's lanes. */
+        inline compiled compile(const ast& tree, bool hoist_literals = false) {
+            compiled c;
+            detail::compiler(tree, hoist_literals, c).run();
+            return c;
+        }
+    }
+}
+
+#endif /* expression_hpp */
@@ -6,72 +6,129 @@
 //
 //  File to randomly generate math equations
 //  To test my thread_queue with an equation solver
+//  Usage: generate_math [-b] [--seed S] [count] [file]. With -b (--binary),
+//  the equations are written as a binary equation file (see
+//  equation_file.hpp) instead of text, to resources/equations.bin by
+//  default. The same seed (2017 by default) always makes the same file.
+
+//  compile this file with -std=c++17 or higher.
 
 #include <iostream>
+#include <cstdlib>
 #include <fstream>
 #include <vector>
-#include <thread>
-#include <sstream>
-#include <future>
 #include <chrono>
-#include <random>
-
-using uniform_dist  = std::uniform_real_distribution<double>; // from <random>
-using rand_int      = std::uniform_int_distribution<unsigned char>;
+#include <algorithm>
+#include <string>
+#include "counter_rng.hpp"
+#include "parallel_algorithms.hpp"
+#include "equation_file.hpp"
+#include "output_writer.hpp"
 
 constexpr char ops [] = { '+', '-', '*', '/'};
-unsigned hwc = std::thread::hardware_concurrency();
-unsigned num_threads = (hwc ? hwc - 1 : 3);
-std::vector<uniform_dist> serializable (num_threads,
-    uniform_dist(-50000.0, 50000.0));
-rand_int randz(0, 3);
-
-std::default_random_engine UNRG;
+/*  Equations are made in chunks of chunk_size IDs, and chunk c draws from
+*   stream c of the seed, so the output depends only on the seed and the
+*   count, never on how many threads made it. */
+constexpr unsigned chunk_size = 4096;
+std::uint64_t Seed = 2017;
 
-// inline typename uniform_dist::result_type makeRand(unsigned i = 0) {
-inline double makeRand(unsigned i = 0) {
-    return (i < num_threads ? serializable[i](UNRG) : 0.0);
-} // this type is double, but I have it more generic
+//* Draws @n equations of chunk @c into a[], op[] and b[].
+void draw_chunk(unsigned c, std::size_t n, double* a, std::uint8_t* op,
+    double* b) {
+    david::random::philox_stream rng (Seed, c);
+    rng.fill_uniform(a, n, -50000.0, 50000.0);
+    rng.fill_bounded(op, n, 4); // the op_code of ops[...]
+    rng.fill_uniform(b, n, -50000.0, 50000.0);
+}
 
-thread_local unsigned so_far_made = 0;
+/*  Runs fn(c) for every chunk c in [0, chunks) on the shared pool, a
+*   chunk at a time, so the pool can balance them. */
+template <class Fn>
+void for_each_chunk(unsigned chunks, Fn fn) {
+    david::thread::parallel_for(0u, chunks, fn, 1u);
+}
 
-void make_thread_equations(unsigned thNum, unsigned num_per_thread,
-    std::ostream* po = &std::cout) {
-    so_far_made = num_per_thread*thNum;
-    auto && o = *po;
-    for (unsigned i = 0; i < num_per_thread; ++i) {
-        std::stringstream ss;
-        ss << so_far_made++ << ": " << makeRand(thNum) << ' '
-            << ops[randz(UNRG)] << ' ' <<makeRand(thNum) << '\n';
-        o << ss.str() << std::flush;
-    }
+/*  Text output: each chunk is formatted into its own lane of @out, so the
+*   file holds the equations in ID order, with no lines interleaved. */
+void make_text_equations(unsigned how_many, david::io::output_writer& out) {
+    unsigned chunks = (how_many + chunk_size - 1) / chunk_size;
+    for_each_chunk(chunks, [&](unsigned c) {
+        unsigned first = c * chunk_size;
+        std::size_t n = std::min(chunk_size, how_many - first);
+        double a[chunk_size], b[chunk_size];
+        std::uint8_t op[chunk_size];
+        draw_chunk(c, n, a, op, b);
+        auto o = out.open_lane(c);
+        for (std::size_t i = 0; i < n; ++i)
+            o << first + i << ": " << a[i] << ' ' << ops[op[i]] << ' '
+                << b[i] << '\n';
+    });
 }
 
-inline void reset_so_far () noexcept {
-    so_far_made = 0;
+/*  Binary output: each chunk fills its own slice of the columns, so there
+*   is nothing to format and no stream to share. */
+struct equation_columns {
+    std::vector<std::uint32_t> ids;
+    std::vector<double>        a, b;
+    std::vector<std::uint8_t>  op;
+    explicit equation_columns(std::size_t n) : ids(n), a(n), b(n), op(n) {}
+};
+
+void make_binary_equations(unsigned how_many, equation_columns& cols) {
+    unsigned chunks = (how_many + chunk_size - 1) / chunk_size;
+    for_each_chunk(chunks, [&](unsigned c) {
+        unsigned first = c * chunk_size;
+        std::size_t n = std::min(chunk_size, how_many - first);
+        for (std::size_t i = 0; i < n; ++i) cols.ids[first + i] = first + i;
+        draw_chunk(c, n, &cols.a[first], &cols.op[first], &cols.b[first]);
+    });
 }
 
 int main(int argc, char* argv[])
 {
+    bool binary = false;
+    for (; argc > 1 && argv[1][0] == '-'; --argc, ++argv) {
+        std::string flag (argv[1]);
+        if (flag == "-b" || flag == "--binary") binary = true;
+        else if (flag == "--seed" && argc > 2) {
+            Seed = std::strtoull(argv[2], nullptr, 0);
+            --argc; ++argv;
+        } else {
+            std::cerr << "Usage: generate_math [-b] [--seed S] [count] "
+                "[file]\n";
+            return 1;
+        }
+    }
     unsigned how_many_eqns = 40000;
     if (argc > 1) how_many_eqns = std::atoi(argv[1]);
-    std::string fileName = "resources/equations.txt";
+    std::string fileName = binary ? "resources/equations.bin"
+        : "resources/equations.txt";
     if (argc > 2) fileName = argv[2];
-    std::ofstream output(fileName);
-    if (!output.is_open()) {
-        std::cerr << "Could not open file " << fileName << std::endl;
-        return 1;
+    if (binary) {
+        std::ofstream output(fileName, std::ios::binary);
+        if (!output.is_open()) {
+            std::cerr << "Could not open file " << fileName << std::endl;
+            return 1;
+        }
+        equation_columns cols (how_many_eqns);
+        make_binary_equations(how_many_eqns, cols);
+        if (!david::io::write_equation_file(output, how_many_eqns,
+            cols.ids.data(), cols.a.data(), cols.op.data(), cols.b.data())) {
+            std::cerr << "Could not write " << fileName << std::endl;
+            return 1;
+        }
+        std::cout << "Done making equations." << std::endl;
+        return 0;
     }
-    unsigned char x = 0;
-    std::vector<std::future<void>> vfut (num_threads);
-    auto num_per_thread = how_many_eqns/(num_threads + 1);
-    for (auto&& thing : vfut) {
-        thing = std::async(std::launch::async, make_thread_equations, x++,
-            num_per_thread, &output);
+    try {
+        david::io::output_writer output(fileName);
+        make_text_equations(how_many_eqns, output);
+        output.close();
+    } catch (std::system_error& se) {
+        std::cerr << "Could not write file " << fileName << ": " << se.what()
+            << std::endl;
+        return 1;
     }
-    make_thread_equations(x, how_many_eqns - num_threads * num_per_thread,
-        &output);
-    for (auto&& thing : vfut) thing.get();
     std::cout << "Done making equations." << std::endl;
     return 0;
 }
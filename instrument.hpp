@@ -0,0 +1,320 @@
+//
+//  instrument.hpp
+//  thread_support
+//
+//*  Optional contention and sojourn instrumentation for the blocking
+//*  containers (thread_queue, thread_priority_queue). Build with
+//*  -DDAVID_THREAD_INSTRUMENT to turn it on; without it, instrument::mutex
+//*  and instrument::condition_variable are plain std::mutex and
+//*  std::condition_variable, the containers carry no extra members, and
+//*  their stats() returns an empty snapshot with enabled == false.
+//*  When on, every container records
+//*    - lock acquisitions, how many were contended (try_lock failed), and
+//*      histograms of the wait for the lock and of the time it was held;
+//*    - condition variable sleeps, spurious wakeups (woken with the
+//*      predicate still false) and timed-out waits;
+//*    - a histogram of each item's sojourn, from push to pop.
+//*  All of it is written by whichever thread holds the container's lock, so
+//*  recording is a plain relaxed load and store; stats() only loads, and may
+//*  be called from any thread at any time without taking the lock.
+
+#ifndef instrument_hpp
+#define instrument_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <string>  // std::to_string
+#include <ostream>
+#include <mutex>
+#include <condition_variable>
+
+namespace david {
+    namespace thread {
+        namespace instrument {
+            //* Whether this build records anything.
+#ifdef DAVID_THREAD_INSTRUMENT
+            constexpr bool enabled = true;
+#else
+            constexpr bool enabled = false;
+#endif
+
+            //* @return: nanoseconds on the steady clock.
+            inline std::uint64_t now() noexcept {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()
+                ).count();
+            }
+
+            //* A copy of a histogram's counts, taken by histogram::snapshot.
+            struct histogram_snapshot {
+                std::uint64_t count = 0;
+                std::uint64_t sum   = 0;
+                std::uint64_t max   = 0;
+                std::vector<std::uint64_t> buckets;
+
+                double mean() const noexcept {
+                    return count ? double(sum) / count : 0.0;
+                }
+
+                /** @return: the value at quantile @param q (0..1), as the top
+                *   of the bucket holding it, so never an underestimate. */
+                std::uint64_t percentile(double q) const noexcept;
+            };
+
+            /** A log-linear histogram in the style of HdrHistogram: values
+            *   below 64 get a bucket each, and every power of two above that
+            *   is split into 32 equal buckets, so a recorded value is known
+            *   to within 1/32 (about 3%). Values of 2^40 ns (18 minutes) and
+            *   over land in the last bucket; max is kept exactly.
+            *   record() must not run concurrently with itself; snapshot()
+            *   may run alongside it. */
+            class histogram {
+                static constexpr unsigned exact_bits = 6;
+                static constexpr unsigned top_bit    = 39;
+                static constexpr std::uint64_t exact = 1u << exact_bits;
+                static constexpr std::uint64_t half  = exact >> 1;
+
+            public:
+                static constexpr std::size_t bucket_count =
+                    exact + (top_bit - exact_bits + 1) * half;
+
+                //* @return: the bucket counting @param v.
+                static std::size_t index(std::uint64_t v) noexcept {
+                    if (v < exact) return std::size_t(v);
+                    unsigned m = 63 - __builtin_clzll(v);
+                    if (m > top_bit) return bucket_count - 1;
+                    unsigned shift = m - exact_bits + 1;
+                    return std::size_t(exact + (m - exact_bits) * half
+                        + ((v >> shift) - half));
+                }
+
+                //* @return: the largest value counted by bucket @param i.
+                static std::uint64_t upper(std::size_t i) noexcept {
+                    if (i < exact) return i;
+                    std::uint64_t k = i - exact;
+                    unsigned shift = unsigned(k / half) + 1;
+                    std::uint64_t top = k % half + half;
+                    return ((top + 1) << shift) - 1;
+                }
+
+                void record(std::uint64_t v) noexcept {
+                    bump(mBuckets[index(v)]);
+                    bump(mCount);
+                    bump(mSum, v);
+                    if (v > mMax.load(std::memory_order_relaxed))
+                        mMax.store(v, std::memory_order_relaxed);
+                }
+
+                histogram_snapshot snapshot() const {
+                    histogram_snapshot s;
+                    s.buckets.resize(bucket_count);
+                    for (std::size_t i = 0; i < bucket_count; ++i) {
+                        s.buckets[i] =
+                            mBuckets[i].load(std::memory_order_relaxed);
+                        s.count += s.buckets[i];
+                    }
+                    s.sum = mSum.load(std::memory_order_relaxed);
+                    s.max = mMax.load(std::memory_order_relaxed);
+                    return s;
+                }
+
+                //* Single-writer increment: a load and a store, no lock prefix.
+                static void bump(std::atomic<std::uint64_t>& a,
+                    std::uint64_t by = 1) noexcept
+                {
+                    a.store(a.load(std::memory_order_relaxed) + by,
+                        std::memory_order_relaxed);
+                }
+
+            private:
+                std::atomic<std::uint64_t> mBuckets[bucket_count] = {};
+                std::atomic<std::uint64_t> mCount {0};
+                std::atomic<std::uint64_t> mSum {0};
+                std::atomic<std::uint64_t> mMax {0};
+            };
+
+            inline std::uint64_t
+            histogram_snapshot::percentile(double q) const noexcept {
+                if (!count) return 0;
+                if (q < 0) q = 0;
+                std::uint64_t want = std::uint64_t(q * count);
+                if (want >= count) want = count - 1;
+                std::uint64_t seen = 0;
+                for (std::size_t i = 0; i < buckets.size(); ++i) {
+                    seen += buckets[i];
+                    if (seen > want) {
+                        std::uint64_t top = histogram::upper(i);
+                        return top < max ? top : max;
+                    }
+                }
+                return max;
+            }
+
+            //* Lock counts and timings, in nanoseconds.
+            struct lock_stats {
+                std::uint64_t acquisitions = 0;
+                std::uint64_t contended    = 0;
+                histogram_snapshot wait;
+                histogram_snapshot hold;
+            };
+
+            //* Condition variable counts.
+            struct wait_stats {
+                std::uint64_t sleeps   = 0;
+                std::uint64_t spurious = 0;
+                std::uint64_t timeouts = 0;
+            };
+
+            //* What a container's stats() returns. Times are in nanoseconds.
+            struct queue_stats {
+                bool enabled = false;
+                lock_stats lock;
+                wait_stats waits;
+                histogram_snapshot sojourn;
+            };
+
+            /** A std::mutex that times its acquisitions and holds. A lock
+            *   that try_lock gets straight away is uncontended and records
+            *   a zero wait. A condition variable wait releases and retakes
+            *   the lock, so it ends one hold and counts one acquisition. */
+            class stat_mutex {
+            public:
+                void lock() {
+                    if (!mMut.try_lock()) {
+                        std::uint64_t t = now();
+                        mMut.lock();
+                        mAcquired = now();
+                        histogram::bump(mContended);
+                        mWait.record(mAcquired - t);
+                    } else {
+                        mAcquired = now();
+                        mWait.record(0);
+                    }
+                    histogram::bump(mAcquisitions);
+                }
+
+                bool try_lock() {
+                    if (!mMut.try_lock()) return false;
+                    mAcquired = now();
+                    mWait.record(0);
+                    histogram::bump(mAcquisitions);
+                    return true;
+                }
+
+                void unlock() {
+                    mHold.record(now() - mAcquired);
+                    mMut.unlock();
+                }
+
+                lock_stats stats() const {
+                    lock_stats s;
+                    s.acquisitions =
+                        mAcquisitions.load(std::memory_order_relaxed);
+                    s.contended = mContended.load(std::memory_order_relaxed);
+                    s.wait = mWait.snapshot();
+                    s.hold = mHold.snapshot();
+                    return s;
+                }
+
+            private:
+                std::mutex mMut;
+                std::uint64_t mAcquired = 0;
+                std::atomic<std::uint64_t> mAcquisitions {0};
+                std::atomic<std::uint64_t> mContended {0};
+                histogram mWait;
+                histogram mHold;
+            };
+
+            /** A condition variable, for stat_mutex, that counts its sleeps,
+            *   spurious wakeups and timeouts. Only the predicate forms are
+            *   offered, since a wakeup is only spurious against one. */
+            class stat_condvar {
+            public:
+                void notify_one() noexcept { mCv.notify_one(); }
+                void notify_all() noexcept { mCv.notify_all(); }
+
+                template <class Lock, class Predicate>
+                void wait(Lock& lk, Predicate pred) {
+                    while (!pred()) {
+                        histogram::bump(mSleeps);
+                        mCv.wait(lk);
+                        if (!pred()) histogram::bump(mSpurious);
+                        else return;
+                    }
+                }
+
+                template <class Lock, class Rep, class Period, class Predicate>
+                bool wait_for(Lock& lk,
+                    const std::chrono::duration<Rep, Period>& d, Predicate pred)
+                {
+                    auto until = std::chrono::steady_clock::now() + d;
+                    while (!pred()) {
+                        histogram::bump(mSleeps);
+                        if (mCv.wait_until(lk, until)
+                            == std::cv_status::timeout) {
+                            histogram::bump(mTimeouts);
+                            return pred();
+                        }
+                        if (!pred()) histogram::bump(mSpurious);
+                        else return true;
+                    }
+                    return true;
+                }
+
+                wait_stats stats() const {
+                    wait_stats s;
+                    s.sleeps = mSleeps.load(std::memory_order_relaxed);
+                    s.spurious = mSpurious.load(std::memory_order_relaxed);
+                    s.timeouts = mTimeouts.load(std::memory_order_relaxed);
+                    return s;
+                }
+
+            private:
+                std::condition_variable_any mCv;
+                std::atomic<std::uint64_t> mSleeps {0};
+                std::atomic<std::uint64_t> mSpurious {0};
+                std::atomic<std::uint64_t> mTimeouts {0};
+            };
+
+#ifdef DAVID_THREAD_INSTRUMENT
+            using mutex = stat_mutex;
+            using condition_variable = stat_condvar;
+#else
+            using mutex = std::mutex;
+            using condition_variable = std::condition_variable;
+#endif
+
+            /** @return: @param s as one line, e.g. for a periodic log:
+            *   acquisitions, % contended, wait and hold p50/p99/max,
+            *   sleeps/spurious/timeouts and sojourn p50/p99/p99.9/max. */
+            inline std::ostream& operator<<(std::ostream& o,
+                const queue_stats& s)
+            {
+                if (!s.enabled) return o << "instrumentation off";
+                auto pct = [](const histogram_snapshot& h) {
+                    return std::to_string(h.percentile(0.5)) + '/'
+                        + std::to_string(h.percentile(0.99)) + '/'
+                        + std::to_string(h.max);
+                };
+                const lock_stats& l = s.lock;
+                o << "lock " << l.acquisitions << " acq, "
+                  << (l.acquisitions ? 100.0 * l.contended / l.acquisitions : 0)
+                  << "% contended, wait " << pct(l.wait)
+                  << " ns, hold " << pct(l.hold) << " ns; "
+                  << s.waits.sleeps << " sleeps, " << s.waits.spurious
+                  << " spurious, " << s.waits.timeouts << " timeouts; "
+                  << "sojourn " << s.sojourn.count << " items "
+                  << s.sojourn.percentile(0.5) << '/'
+                  << s.sojourn.percentile(0.99) << '/'
+                  << s.sojourn.percentile(0.999) << '/'
+                  << s.sojourn.max << " ns";
+                return o;
+            }
+        }
+    }
+}
+
+#endif /* instrument_hpp */
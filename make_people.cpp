@@ -6,101 +6,290 @@
 //
 //  File to randomly generate people's names and ages.
 //  To test my thread_priority_queue with an online sorter
-//  argv[1] is the number of output files to generate
+//  Usage: make_people [-j T] [--records R] [--ages A] [--seed S] [-b] <N>
+//  {files}. argv[N] is the number of output files to generate.
+//  People are made in chunks of chunk_size, and chunk c of file k draws from
+//  its own stream of a counter-based generator (counter_rng.hpp), so the
+//  same seed always makes the same people, whatever -j is. The seed is 2017,
+//  or a hash of the output file names when they are given.
+//  Every chunk of every file is one task, run on the shared task_pool (or,
+//  with -j, on a pool of T threads), each formatting its chunk into its
+//  own lane of the file's output_writer, or, with -b, writing packed
+//  person_records (people.hpp) straight to their place in a binary file.
+
+//  compile this file with -std=c++17 or higher.
 
 #include <iostream>
-#include <fstream>
-#include <random>
 #include <string>
 #include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cmath>       // std::sqrt
+#include <cstdint>
+#include <cstdlib>
+#include <cerrno>
+#include <system_error>
+#include <fcntl.h>     // open
+#include <unistd.h>    // pwrite, ftruncate, close
+#include "counter_rng.hpp"
+#include "output_writer.hpp"
+#include "people.hpp"
+#include "parallel_algorithms.hpp"
 
 // declare vectors of first and last names. Take up space
 #include "resources/names_f.txt"
 #include "resources/names_l.txt"
 
-const auto NFN = FirstNames.size() - 1, NLN = LastNames.size() - 1;
-
-using rand_short = std::uniform_int_distribution<unsigned short>;
-// using rand_byte  = std::uniform_int_distribution<unsigned char>;
-std::default_random_engine UNRG;
-rand_short Randy_Marsh(8, 90), Rick_Sanchez(0, NFN), Morty_Smith(0, NLN);
-rand_short Bojack_Horseman(128, 20000), Mike_Shindler(0, 11), Aaron_Cote(0, 30);
-auto Randy  = [&](){ return Randy_Marsh   (UNRG); }; // for ages
-auto Rick   = [&](){ return Rick_Sanchez  (UNRG); }; // for first names
-auto Morty  = [&](){ return Morty_Smith   (UNRG); }; // for last names
-auto Bojack = [&](){ return Bojack_Horseman(UNRG);}; // for #people per file
-auto Shindy = [&](){ return Mike_Shindler (UNRG); }; // for age months
-auto Cote   = [&](){ return Aaron_Cote    (UNRG); }; // for age days
-
-const std::string& getFirst() { return FirstNames[Rick()]; }
-const std::string& getLast () { return LastNames [Morty()];}
-
-void writePerson(std::ostream& o = std::cout) {
-    o << Randy() << ' ' << Shindy() << ' ' << Cote()
-        << '\t' << getFirst() << ' ' << getLast() << std::endl;
+using david::random::philox_stream;
+using david::people::person_record;
+using david::people::name_id;
+using david::thread::task_pool;
+
+const unsigned NFN = FirstNames.size(), NLN = LastNames.size();
+
+std::uint64_t Seed = 2017;
+constexpr unsigned chunk_size = 1 << 16;
+//* Stream numbers: file << 32 | chunk for people, count_stream | file for
+//  the number of people in a file.
+constexpr std::uint64_t count_stream = 1ull << 63;
+
+//* How ages are spread over [8, 90]
+enum age_shape { uniform, young, old, peaked };
+
+/*  @return: an age in [8, 90] for @u, uniform in [0, 1). young and old
+*   crowd towards either end (the distance from it goes as u squared);
+*   peaked is triangular around 49. */
+inline unsigned shape_age(double u, age_shape shape) {
+    switch (shape) {
+    case young:  return 8  + unsigned(83 * u * u);
+    case old:    return 90 - unsigned(83 * u * u);
+    case peaked: return 8  + unsigned(83 * (u < 0.5 ? std::sqrt(u / 2)
+                                : 1 - std::sqrt((1 - u) / 2)));
+    default:     return 8  + unsigned(83 * u);
+    }
 }
 
-inline void argError() {
-    std::cerr << "Usage: make_people <N> {files}\n"
-        << "<N> is a positive number of files to generate people in.\n"
-        << "{files} is either empty or a list of N output file names.\n"
-        << "If it is empty, files will be output/people{1..N}.txt\n";
+//* One chunk of one file: people [first, first + n) of file @file.
+struct chunk_task {
+    unsigned      file, chunk;
+    std::uint64_t first;
+    unsigned      n;
+};
+
+//* One chunk's draws, reused by each worker.
+struct chunk_draws {
+    std::vector<double>       u;
+    std::vector<std::uint8_t> months, days;
+    std::vector<name_id>      first, last;
+
+    void draw(const chunk_task& t, age_shape shape,
+        std::vector<std::uint8_t>& ages)
+    {
+        u.resize(t.n); months.resize(t.n); days.resize(t.n);
+        first.resize(t.n); last.resize(t.n); ages.resize(t.n);
+        philox_stream rng (Seed, std::uint64_t(t.file) << 32 | t.chunk);
+        rng.fill_uniform(u.data(), t.n, 0.0, 1.0);
+        rng.fill_bounded(months.data(), t.n, 12);
+        rng.fill_bounded(days.data(), t.n, 31);
+        rng.fill_bounded(first.data(), t.n, NFN);
+        rng.fill_bounded(last.data(), t.n, NLN);
+        for (unsigned i = 0; i < t.n; ++i) ages[i] = shape_age(u[i], shape);
+    }
+};
+
+/*  Runs fn(tasks[i]) for every task on @pool. parallel_for works through a
+*   range from its low end and only hands off upper parts, so the lowest
+*   task not yet done is always running: its lane is its file's head and
+*   never waits for room. */
+template <class Fn>
+void for_each_task(const std::vector<chunk_task>& tasks, task_pool& pool,
+    Fn fn) {
+    david::thread::parallel_for(std::size_t(0), tasks.size(),
+        [&](std::size_t i) { fn(tasks[i]); }, std::size_t(1), pool);
 }
 
-std::string fileName() {
-    static unsigned _xxx = 1;
-    return std::string("output/people" + std::to_string(_xxx++) + ".txt");
+/*  Text output: the count on the first line (lane 0), then chunk c of each
+*   file in lane c + 1, as "Y M D\tFirst Last" lines. */
+void make_text_people(const std::vector<std::string>& files,
+    const std::vector<std::uint64_t>& counts,
+    const std::vector<chunk_task>& tasks, task_pool& pool, age_shape shape)
+{
+    using david::io::output_writer;
+    std::vector<std::unique_ptr<output_writer>> outputs;
+    for (unsigned f = 0; f < files.size(); ++f) {
+        outputs.emplace_back(new output_writer(files[f], 16 << 20));
+        outputs.back()->open_lane(0) << counts[f] << '\n';
+    }
+    for_each_task(tasks, pool, [&](const chunk_task& t) {
+        thread_local chunk_draws d;
+        thread_local std::vector<std::uint8_t> ages;
+        d.draw(t, shape, ages);
+        auto o = outputs[t.file]->open_lane(t.chunk + 1);
+        for (unsigned i = 0; i < t.n; ++i)
+            o << unsigned(ages[i]) << ' ' << unsigned(d.months[i]) << ' '
+                << unsigned(d.days[i]) << '\t' << FirstNames[d.first[i]]
+                << ' ' << LastNames[d.last[i]] << '\n';
+    });
+    for (auto&& out : outputs) out->close();
 }
 
-std::vector<std::string>& genFNames(unsigned n = 1) {
-    static bool made = false;
-    static std::vector<std::string> vec{n};
-    if (!made) {
-        for (auto&& th: vec) th = fileName();
-        made = true;
+//* Writes all of [@p, @p + @bytes) to @fd at @offset.
+bool pwrite_all(int fd, const void* p, std::size_t bytes, off_t offset) {
+    auto c = static_cast<const char*>(p);
+    while (bytes) {
+        ssize_t done = ::pwrite(fd, c, bytes, offset);
+        if (done < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        c += done; bytes -= done; offset += done;
     }
-    return vec;
+    return true;
 }
 
-std::vector<std::string>& getFNames(char** argv, unsigned n = 1) {
-    static bool made = false;
-    static std::vector<std::string> vec{n};
-    static auto i = 0;
-    if (!made) {
-        for (auto&& th: vec) th = argv[++i + 1];
-        made = true;
+/*  Binary output: a people file holding every first name, then every last
+*   name, so a record's last name ID is offset by NFN. Each chunk is packed
+*   and written at its own offset; nothing is shared but the descriptor. */
+void make_binary_people(const std::vector<std::string>& files,
+    const std::vector<std::uint64_t>& counts,
+    const std::vector<chunk_task>& tasks, task_pool& pool, age_shape shape)
+{
+    std::vector<std::string> names (FirstNames);
+    names.insert(names.end(), LastNames.begin(), LastNames.end());
+    std::vector<int> fds;
+    std::vector<off_t> records_at;
+    for (unsigned f = 0; f < files.size(); ++f) {
+        int fd = ::open(files[f].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(),
+                "open " + files[f]);
+        fds.push_back(fd);
+        std::string prefix = david::people::people_file_prefix(names,
+            counts[f]);
+        records_at.push_back(prefix.size());
+        if (!pwrite_all(fd, prefix.data(), prefix.size(), 0) || ::ftruncate(
+            fd, prefix.size() + counts[f] * sizeof(person_record)) != 0)
+            throw std::system_error(errno, std::generic_category(),
+                "write " + files[f]);
     }
-    return vec;
+    std::atomic<int> error {0};
+    for_each_task(tasks, pool, [&](const chunk_task& t) {
+        thread_local chunk_draws d;
+        thread_local std::vector<std::uint8_t> ages;
+        thread_local std::vector<person_record> records;
+        d.draw(t, shape, ages);
+        records.resize(t.n);
+        for (unsigned i = 0; i < t.n; ++i)
+            records[i] = person_record {david::people::pack_age(ages[i],
+                d.months[i], d.days[i]), d.first[i],
+                name_id(NFN + d.last[i])};
+        if (!pwrite_all(fds[t.file], records.data(),
+            t.n * sizeof(person_record),
+            records_at[t.file] + t.first * sizeof(person_record)))
+            error = errno;
+    });
+    for (auto&& fd : fds) ::close(fd);
+    if (error)
+        throw std::system_error(error, std::generic_category(), "write");
+}
+
+inline void argError() {
+    std::cerr << "Usage: make_people [-j T] [--records R] [--ages A] "
+        << "[--seed S] [-b] <N> {files}\n"
+        << "<N> is a positive number of files to generate people in.\n"
+        << "{files} is either empty or a list of N output file names.\n"
+        << "If it is empty, files will be output/people{1..N}.txt (.bin)\n"
+        << "-j (--threads) T  workers to use (default: one per core)\n"
+        << "--records R       people per file (default: 128-20000 each)\n"
+        << "--ages A          uniform (default), young, old or peaked\n"
+        << "--seed S          seed (default: 2017, or from the file names)\n"
+        << "-b (--binary)     write binary people files (see people.hpp)\n";
 }
 
-template <typename T>
-inline std::size_t _s_int(T* pT) { return reinterpret_cast<std::size_t>(pT);}
+//* FNV-1a over the output file names, for a seed that follows them
+std::uint64_t hashNames(char** first, char** last) {
+    std::uint64_t h = 0xcbf29ce484222325ull;
+    for (; first != last; ++first)
+        for (const char* c = *first; ; ++c) {
+            h = (h ^ std::uint8_t(*c)) * 0x100000001b3ull;
+            if (!*c) break; // the terminator separates names
+        }
+    return h;
+}
 
 int main(int argc, char* argv[])
 {
+    unsigned threads = 0; // 0: the shared pool, a thread per core
+    std::uint64_t records = 0; // 0: drawn per file
+    age_shape shape = uniform;
+    bool binary = false, seeded = false;
+    for (; argc > 1 && argv[1][0] == '-'; --argc, ++argv) {
+        std::string flag (argv[1]);
+        if (flag == "-b" || flag == "--binary") { binary = true; continue; }
+        if (argc < 3) { argError(); return 1; }
+        std::string value (argv[2]);
+        if (flag == "-j" || flag == "--threads")
+            threads = std::max(1, std::atoi(argv[2]));
+        else if (flag == "--records")
+            records = std::strtoull(argv[2], nullptr, 0);
+        else if (flag == "--seed") {
+            Seed = std::strtoull(argv[2], nullptr, 0);
+            seeded = true;
+        } else if (flag == "--ages" && value == "uniform") shape = uniform;
+        else if (flag == "--ages" && value == "young") shape = young;
+        else if (flag == "--ages" && value == "old") shape = old;
+        else if (flag == "--ages" && value == "peaked") shape = peaked;
+        else { argError(); return 1; }
+        --argc; ++argv;
+    }
     if (argc < 2) {
         argError(); return -1;
     }
-    unsigned N = std::atoi(argv[1]);
-    if (N < 1) {
+    int N = std::atoi(argv[1]);
+    if (N < 1 || (argc > 2 && argc != N + 2)) {
         argError(); return 2;
     }
-    if (argc > 2) { // make random seeds from file names of input arguments
-        std::seed_seq seedy {_s_int(&argv[1]), _s_int(&argv[N])};
-        UNRG.seed(seedy);
+    std::vector<std::string> outFiles;
+    if (argc > 2) {
+        outFiles.assign(&argv[2], &argv[argc]);
+        // make random seeds from file names of input arguments
+        if (!seeded) Seed = hashNames(&argv[2], &argv[argc]);
+    } else {
+        for (int k = 1; k <= N; ++k)
+            outFiles.push_back("output/people" + std::to_string(k)
+                + (binary ? ".bin" : ".txt"));
     }
-    /* I must have expressions of the same data type (vector::string::iterator)
-    *  for the ternary operator that follows. So I construct a vector either
-    *  from N calls to fileName(), or argv[2..N+1]. */
-    auto&& a = argv;
-    std::vector<std::string> outFiles= argc > 2 ? getFNames(a,N) : genFNames(N);
-    std::vector<std::ofstream> outputs {outFiles.begin(), outFiles.end()};
-    for (auto&& out : outputs) {
-        auto X = Bojack();
-        out << X << std::endl;
-        for (auto k = 0; k < X; ++k) {
-            writePerson(out);
-        }
+
+    std::vector<std::uint64_t> counts;
+    std::vector<chunk_task> tasks;
+    for (unsigned f = 0; f < outFiles.size(); ++f) {
+        philox_stream rng (Seed, count_stream | f);
+        counts.push_back(records ? records : 128 + rng.bounded(20000 - 127));
+        for (std::uint64_t c = 0, at = 0; at < counts[f]; ++c, at += chunk_size)
+            tasks.push_back(chunk_task {f, unsigned(c), at, unsigned(
+                std::min<std::uint64_t>(chunk_size, counts[f] - at))});
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    try {
+        std::unique_ptr<task_pool> own (threads ? new task_pool(threads - 1)
+            : nullptr);
+        task_pool& pool = own ? *own : task_pool::shared();
+        if (binary) make_binary_people(outFiles, counts, tasks, pool, shape);
+        else        make_text_people  (outFiles, counts, tasks, pool, shape);
+    } catch (std::system_error& se) {
+        std::cerr << se.what() << std::endl;
+        return 3;
     }
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now()
+        - start;
+    std::uint64_t total = 0;
+    for (auto&& n : counts) total += n;
+    std::cout << "Made " << total << " people in " << outFiles.size()
+        << " files in " << secs.count() << " s ("
+        << std::uint64_t(total / secs.count()) << " people/s)." << std::endl;
     return 0;
 }
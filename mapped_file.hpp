@@ -0,0 +1,200 @@
+//
+//  mapped_file.hpp
+//  thread_support
+//
+//*  Shared input layer for the people and equation files: a read-only
+//*  memory mapping, newline-aligned chunking for parallel parsing, and
+//*  allocation-free number parsing straight from the mapped bytes.
+//*  Compile with -std=c++17 or higher (std::from_chars, std::string_view).
+
+#ifndef mapped_file_hpp
+#define mapped_file_hpp
+
+#include <cstddef>
+#include <cerrno>
+#include <cstring>     // std::memchr
+#include <charconv>    // std::from_chars
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <system_error>
+#include <utility>     // std::exchange
+#include <fcntl.h>     // open
+#include <unistd.h>    // close
+#include <sys/mman.h>  // mmap, munmap, madvise
+#include <sys/stat.h>  // fstat
+#include "parallel_algorithms.hpp"
+
+namespace david {
+    namespace io {
+        /** A read-only, private mapping of a whole file. Move-only; the
+        *   mapping is released when the last owner is destroyed.
+        *   An empty file maps to an empty range. */
+        class mapped_file {
+            const char* mData = nullptr;
+            std::size_t mSize = 0;
+
+            void release() noexcept {
+                if (mData && mSize)
+                    ::munmap(const_cast<char*>(mData), mSize);
+                mData = nullptr; mSize = 0;
+            }
+        public:
+            mapped_file() = default;
+
+            /** Maps the file at @param path.
+            *   @throw std::system_error if it cannot be opened or mapped. */
+            explicit mapped_file(const std::string& path) {
+                int fd = ::open(path.c_str(), O_RDONLY);
+                if (fd < 0)
+                    throw std::system_error(errno, std::generic_category(),
+                        "open " + path);
+                struct stat st;
+                if (::fstat(fd, &st) < 0) {
+                    int err = errno; ::close(fd);
+                    throw std::system_error(err, std::generic_category(),
+                        "stat " + path);
+                }
+                mSize = static_cast<std::size_t>(st.st_size);
+                if (mSize) {
+                    void* p = ::mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE,
+                        fd, 0);
+                    if (p == MAP_FAILED) {
+                        int err = errno; ::close(fd);
+                        throw std::system_error(err, std::generic_category(),
+                            "mmap " + path);
+                    }
+                    ::madvise(p, mSize, MADV_SEQUENTIAL);
+                    mData = static_cast<const char*>(p);
+                }
+                ::close(fd); // the mapping keeps its own reference
+            }
+
+            mapped_file(const mapped_file&) = delete;
+            mapped_file& operator=(const mapped_file&) = delete;
+
+            mapped_file(mapped_file&& rhs) noexcept
+            : mData(std::exchange(rhs.mData, nullptr)),
+              mSize(std::exchange(rhs.mSize, 0)) {}
+
+            mapped_file& operator=(mapped_file&& rhs) noexcept {
+                if (this != &rhs) {
+                    release();
+                    mData = std::exchange(rhs.mData, nullptr);
+                    mSize = std::exchange(rhs.mSize, 0);
+                }
+                return *this;
+            }
+
+            ~mapped_file() { release(); }
+
+            const char* begin() const noexcept { return mData; }
+            const char* end()   const noexcept { return mData + mSize; }
+            std::size_t size()  const noexcept { return mSize; }
+            bool empty()        const noexcept { return mSize == 0; }
+            std::string_view view() const noexcept { return {mData, mSize}; }
+        };
+
+        //* A half-open range of whole lines.
+        struct text_chunk {
+            const char* first;
+            const char* last;
+            std::size_t size() const noexcept { return last - first; }
+        };
+
+        /** @return: the start of the line after the one @param p is on,
+        *   or @param last. */
+        inline const char* next_line(const char* p, const char* last) noexcept
+        {
+            if (p == last) return last;
+            auto nl = static_cast<const char*>(std::memchr(p, '\n', last - p));
+            return nl ? nl + 1 : last;
+        }
+
+        /** Splits [first, last) into at most @param n chunks of roughly equal
+        *   size, each ending just after a newline (or at @param last), and
+        *   none smaller than @param min_size bytes except the final one. */
+        inline std::vector<text_chunk> split_lines(const char* first,
+            const char* last, std::size_t n, std::size_t min_size = 1 << 16)
+        {
+            std::vector<text_chunk> chunks;
+            std::size_t total = last - first;
+            if (n == 0) n = 1;
+            std::size_t step = total / n;
+            if (step < min_size) step = min_size;
+            while (first != last) {
+                const char* cut = (std::size_t(last - first) <= step) ? last
+                    : next_line(first + step, last);
+                chunks.push_back(text_chunk {first, cut});
+                first = cut;
+            }
+            return chunks;
+        }
+
+        inline std::size_t default_chunks() noexcept {
+            unsigned hwc = std::thread::hardware_concurrency();
+            return hwc ? hwc : 4;
+        }
+
+        //* Skips spaces, tabs and carriage returns, but not newlines.
+        inline const char* skip_blanks(const char* p, const char* last)
+            noexcept
+        {
+            while (p != last && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+            return p;
+        }
+
+        /** Parses an integer after optional blanks, advancing @param p past
+        *   it on success. @return: whether a number was read. */
+        template <typename Int>
+        inline bool parse_int(const char*& p, const char* last, Int& value)
+            noexcept
+        {
+            const char* q = skip_blanks(p, last);
+            auto res = std::from_chars(q, last, value);
+            if (res.ec != std::errc()) return false;
+            p = res.ptr;
+            return true;
+        }
+
+        /** Parses a double after optional blanks (and an optional '+', which
+        *   std::from_chars does not accept), advancing @param p past it on
+        *   success. @return: whether a number was read. */
+        inline bool parse_double(const char*& p, const char* last,
+            double& value) noexcept
+        {
+            const char* q = skip_blanks(p, last);
+            if (q != last && *q == '+') ++q;
+            auto res = std::from_chars(q, last, value);
+            if (res.ec != std::errc()) return false;
+            p = res.ptr;
+            return true;
+        }
+
+        /** Reads the next blank-delimited word after optional blanks.
+        *   @return: the word, pointing into the input, or an empty view. */
+        inline std::string_view parse_word(const char*& p, const char* last)
+            noexcept
+        {
+            const char* q = skip_blanks(p, last);
+            const char* w = q;
+            while (q != last && *q != ' ' && *q != '\t' && *q != '\r'
+                && *q != '\n') ++q;
+            p = q;
+            return std::string_view(w, q - w);
+        }
+
+        /** Runs fn(i, chunks[i]) for every chunk, a task per chunk, on the
+        *   shared task_pool.
+        *   @throw the first exception fn threw, once all calls are over */
+        template <class Fn>
+        void for_each_chunk(const std::vector<text_chunk>& chunks, Fn&& fn) {
+            thread::parallel_for(std::size_t(0), chunks.size(),
+                [&fn, &chunks](std::size_t i) { fn(i, chunks[i]); },
+                std::size_t(1));
+        }
+    }
+}
+
+#endif /* mapped_file_hpp */
@@ -0,0 +1,164 @@
+//
+//  memo_cache.hpp
+//  thread_support
+//
+//*  A bounded, concurrent memoization cache. Keys hash to one of several
+//*  independently locked shards, so threads rarely contend; each shard
+//*  holds a fixed number of slots and evicts with the CLOCK algorithm
+//*  (a second-chance approximation of LRU), so memory never grows past the
+//*  capacity given at construction. Hit and miss counts are kept per shard
+//*  and summed on demand.
+
+#ifndef memo_cache_hpp
+#define memo_cache_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <memory>     // std::unique_ptr
+#include <functional> // std::hash
+
+namespace david {
+    namespace thread {
+        template <typename K, typename V, class Hash = std::hash<K> >
+        class memo_cache {
+        public:
+            using key_type    = K;
+            using mapped_type = V;
+            using size_type   = std::size_t;
+
+            //* Totals across all shards at the time of the call.
+            struct stats_type {
+                std::uint64_t hits, misses, evictions;
+                size_type size, capacity;
+            };
+
+        private:
+            struct slot {
+                key_type    key;
+                mapped_type value;
+                bool        referenced;
+            };
+
+            /** One shard: CLOCK over a fixed array of slots, with a hash
+            *   index from key to slot. Aligned so that neighbouring shards'
+            *   locks and counters never share a cache line. */
+            struct alignas(64) shard {
+                std::mutex mut;
+                std::vector<slot> slots;
+                std::unordered_map<key_type, size_type, Hash> index;
+                size_type hand = 0;
+                std::uint64_t hits = 0, misses = 0, evictions = 0;
+            };
+
+            std::unique_ptr<shard[]> mShards;
+            size_type mNumShards;
+            size_type mPerShard;
+            Hash mHash;
+
+            shard& shard_for(const key_type& key) {
+                // mix the high bits in; std::hash of integers is the identity
+                std::size_t h = mHash(key);
+                h ^= h >> 29; h *= 0xbf58476d1ce4e5b9ull; h ^= h >> 32;
+                return mShards[h % mNumShards];
+            }
+
+            //* Requires sh.mut. @return: a free or evicted slot's index.
+            size_type claim_slot(shard& sh) {
+                if (sh.slots.size() < mPerShard) {
+                    sh.slots.emplace_back();
+                    return sh.slots.size() - 1;
+                }
+                // second chance: clear reference bits until one is unset
+                while (sh.slots[sh.hand].referenced) {
+                    sh.slots[sh.hand].referenced = false;
+                    sh.hand = (sh.hand + 1) % mPerShard;
+                }
+                size_type victim = sh.hand;
+                sh.hand = (sh.hand + 1) % mPerShard;
+                sh.index.erase(sh.slots[victim].key);
+                ++sh.evictions;
+                return victim;
+            }
+
+        public:
+            /** Constructs an empty cache.
+            *   @param <capacity>: the most entries held at once (at least
+            *   one per shard)
+            *   @param <shards>: the number of independently locked shards */
+            explicit memo_cache(size_type capacity = 1 << 16,
+                size_type shards = 64)
+            : mShards(new shard[shards ? shards : 1]),
+              mNumShards(shards ? shards : 1),
+              mPerShard(capacity / mNumShards ? capacity / mNumShards : 1)
+            {
+                for (size_type s = 0; s < mNumShards; ++s) {
+                    mShards[s].slots.reserve(mPerShard);
+                    mShards[s].index.reserve(mPerShard);
+                }
+            }
+
+            memo_cache(const memo_cache&) = delete;
+            memo_cache& operator=(const memo_cache&) = delete;
+
+            /** Looks up @param key, overwriting @param value on a hit.
+            *   @return: whether it was found. */
+            bool find(const key_type& key, mapped_type& value) {
+                shard& sh = shard_for(key);
+                std::lock_guard<std::mutex> lk(sh.mut);
+                auto it = sh.index.find(key);
+                if (it == sh.index.end()) {
+                    ++sh.misses;
+                    return false;
+                }
+                slot& s = sh.slots[it->second];
+                s.referenced = true;
+                value = s.value;
+                ++sh.hits;
+                return true;
+            }
+
+            /** Stores @param value for @param key, evicting if need be. */
+            void insert_or_assign(const key_type& key, mapped_type value) {
+                shard& sh = shard_for(key);
+                std::lock_guard<std::mutex> lk(sh.mut);
+                auto it = sh.index.find(key);
+                size_type i = (it != sh.index.end()) ? it->second
+                    : claim_slot(sh);
+                sh.slots[i].key = key;
+                sh.slots[i].value = std::move(value);
+                sh.slots[i].referenced = false;
+                sh.index[key] = i;
+            }
+
+            /** @return: the cached value for @param key, or fn(), which is
+            *   then cached. fn runs outside the lock, so two threads missing
+            *   on the same key at once may both call it. */
+            template <class Fn>
+            mapped_type get_or_compute(const key_type& key, Fn&& fn) {
+                mapped_type value;
+                if (find(key, value)) return value;
+                value = fn();
+                insert_or_assign(key, value);
+                return value;
+            }
+
+            stats_type stats() const {
+                stats_type st {0, 0, 0, 0, mPerShard * mNumShards};
+                for (size_type s = 0; s < mNumShards; ++s) {
+                    shard& sh = mShards[s];
+                    std::lock_guard<std::mutex> lk(sh.mut);
+                    st.hits      += sh.hits;
+                    st.misses    += sh.misses;
+                    st.evictions += sh.evictions;
+                    st.size      += sh.index.size();
+                }
+                return st;
+            }
+        };
+    }
+}
+
+#endif /* memo_cache_hpp */
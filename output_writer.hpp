@@ -0,0 +1,330 @@
+//
+//  output_writer.hpp
+//  thread_support
+//
+//*  Shared output for the generators and solvers. Each producing thread
+//*  formats into its own lane: a large private buffer that is handed, once
+//*  full, to a single writer thread, which issues one writev() per batch of
+//*  buffers. Lanes are numbered, and the file always holds lane 0's text,
+//*  then lane 1's, and so on, however the threads are scheduled; a lane's
+//*  buffers are written as soon as every lane before it has been closed.
+//*  Numbers are formatted with std::to_chars, and doubles exactly as an
+//*  std::ostream would print them by default (%g, precision 6).
+//*  Compile with -std=c++17 or higher.
+
+#ifndef output_writer_hpp
+#define output_writer_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <charconv>    // std::to_chars
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <system_error>
+#include <type_traits>
+#include <utility>     // std::exchange
+#include <fcntl.h>     // open
+#include <unistd.h>    // close
+#include <sys/uio.h>   // writev, IOV_MAX
+#include <climits>
+
+namespace david {
+    namespace io {
+        //* Appends the decimal digits of @param v to @param buf.
+        template <typename Int, typename = typename
+            std::enable_if<std::is_integral<Int>::value>::type>
+        inline void append_int(std::string& buf, Int v) {
+            char digits[24];
+            auto res = std::to_chars(digits, digits + sizeof digits, v);
+            buf.append(digits, res.ptr);
+        }
+
+        /** Appends @param v to @param buf as `std::ostream << v` would with
+        *   the default flags and precision. */
+        inline void append_double(std::string& buf, double v) {
+            char digits[32];
+            auto res = std::to_chars(digits, digits + sizeof digits, v,
+                std::chars_format::general, 6);
+            buf.append(digits, res.ptr);
+        }
+
+        /** The formatting operators shared by string_formatter and
+        *   output_writer::lane. Derived supplies buffer(), the string to
+        *   append to, and wrote(), called after every append. */
+        template <class Derived>
+        class formatter {
+            Derived& self() noexcept { return static_cast<Derived&>(*this); }
+        public:
+            Derived& operator<<(char c) {
+                self().buffer() += c; self().wrote(); return self();
+            }
+            Derived& operator<<(std::string_view s) {
+                self().buffer() += s; self().wrote(); return self();
+            }
+            Derived& operator<<(const char* s) {
+                return *this << std::string_view(s);
+            }
+            Derived& operator<<(const std::string& s) {
+                return *this << std::string_view(s);
+            }
+            Derived& operator<<(double v) {
+                append_double(self().buffer(), v); self().wrote();
+                return self();
+            }
+            template <typename Int> typename std::enable_if<
+                std::is_integral<Int>::value
+                && !std::is_same<Int, char>::value, Derived&>::type
+            operator<<(Int v) {
+                append_int(self().buffer(), v); self().wrote();
+                return self();
+            }
+        };
+
+        //* Formats onto the end of a std::string the caller owns.
+        class string_formatter : public formatter<string_formatter> {
+            std::string* mBuf;
+        public:
+            explicit string_formatter(std::string& buf) noexcept
+            : mBuf(&buf) {}
+            std::string& buffer() noexcept { return *mBuf; }
+            void wrote() noexcept {}
+        };
+
+        class output_writer {
+        public:
+            using size_type = std::size_t;
+
+            static constexpr size_type buffer_size = 1 << 20;
+
+            /** One producer's ordered run of output. Move-only; it is closed
+            *   (and its last buffer handed over) on destruction. */
+            class lane : public formatter<lane> {
+                output_writer* mOut = nullptr;
+                size_type      mIndex = 0;
+                std::string    mBuf;
+
+            public:
+                lane() = default;
+                lane(output_writer* out, size_type index)
+                : mOut(out), mIndex(index), mBuf(out->take_buffer()) {}
+
+                lane(lane&& rhs) noexcept
+                : mOut(std::exchange(rhs.mOut, nullptr)), mIndex(rhs.mIndex),
+                  mBuf(std::move(rhs.mBuf)) {}
+                lane& operator=(lane&& rhs) noexcept {
+                    if (this != &rhs) {
+                        close();
+                        mOut = std::exchange(rhs.mOut, nullptr);
+                        mIndex = rhs.mIndex;
+                        mBuf = std::move(rhs.mBuf);
+                    }
+                    return *this;
+                }
+                ~lane() { close(); }
+
+                std::string& buffer() noexcept { return mBuf; }
+                //* Hands the buffer over once it is full.
+                void wrote() {
+                    if (mBuf.size() >= buffer_size) {
+                        mOut->submit(mIndex, std::move(mBuf), false);
+                        mBuf = mOut->take_buffer();
+                    }
+                }
+
+                //* Hands over what is left; nothing more may be written.
+                void close() {
+                    if (!mOut) return;
+                    mOut->submit(mIndex, std::move(mBuf), true);
+                    mOut = nullptr;
+                }
+            };
+
+        private:
+            struct lane_state {
+                std::deque<std::string> ready;
+                bool closed = false;
+            };
+
+            int  mFd;
+            bool mOwnsFd;
+            size_type mMaxPending;
+            std::map<size_type, lane_state> mLanes; // lanes not yet written
+            size_type mHead = 0;                    // the lane being written
+            size_type mPending = 0;                 // bytes queued
+            std::vector<std::string> mFree;         // recycled buffers
+            bool mClosing = false;
+            int  mError = 0;
+            std::mutex mMut;
+            std::condition_variable mHasWork, mHasRoom;
+            std::thread mWriter;
+            //* Convenience typedefs
+            using LGuard = std::lock_guard<std::mutex>;
+            using ULock = std::unique_lock<std::mutex>;
+
+            std::string take_buffer() {
+                std::string buf;
+                {
+                    LGuard lk(mMut);
+                    if (!mFree.empty()) {
+                        buf = std::move(mFree.back());
+                        mFree.pop_back();
+                    }
+                }
+                buf.clear();
+                buf.reserve(buffer_size + 256);
+                return buf;
+            }
+
+            /*  Queues @buf for lane @index. Lanes after the one being
+            *   written wait while too much is queued; the head never does,
+            *   so the writer always has something it can drain. */
+            void submit(size_type index, std::string&& buf, bool last) {
+                ULock lk(mMut);
+                mHasRoom.wait(lk, [this, index]{
+                    return index <= mHead || mPending < mMaxPending
+                        || mError;
+                });
+                auto&& ln = mLanes[index];
+                mPending += buf.size();
+                if (!buf.empty()) ln.ready.push_back(std::move(buf));
+                if (last) ln.closed = true;
+                if (index == mHead || mClosing) mHasWork.notify_one();
+            }
+
+            //* Writes every byte of @param iov, resuming after short writes.
+            bool write_all(std::vector<iovec>& iov) {
+                std::size_t at = 0;
+                while (at < iov.size()) {
+                    int n = int(std::min<std::size_t>(iov.size() - at,
+                        IOV_MAX));
+                    ssize_t done = ::writev(mFd, &iov[at], n);
+                    if (done < 0) {
+                        if (errno == EINTR) continue;
+                        return false;
+                    }
+                    for (std::size_t left = done; left; ) {
+                        if (left >= iov[at].iov_len) {
+                            left -= iov[at].iov_len; ++at;
+                        } else {
+                            iov[at].iov_base =
+                                static_cast<char*>(iov[at].iov_base) + left;
+                            iov[at].iov_len -= left;
+                            left = 0;
+                        }
+                    }
+                    while (at < iov.size() && iov[at].iov_len == 0) ++at;
+                }
+                return true;
+            }
+
+            /*  Moves every buffer that may be written now, in order, into
+            *   @batch, advancing the head past closed lanes. Requires mMut. */
+            void collect(std::vector<std::string>& batch) {
+                while (!mLanes.empty()) {
+                    auto it = mLanes.begin();
+                    // once closing, lanes never opened are skipped
+                    if (it->first != mHead && !mClosing) break;
+                    mHead = it->first;
+                    auto&& ln = it->second;
+                    while (!ln.ready.empty()) {
+                        batch.push_back(std::move(ln.ready.front()));
+                        ln.ready.pop_front();
+                    }
+                    if (!ln.closed) break;
+                    mLanes.erase(it);
+                    ++mHead;
+                    mHasRoom.notify_all();
+                }
+            }
+
+            void run() {
+                std::vector<std::string> batch;
+                std::vector<iovec> iov;
+                ULock lk(mMut);
+                for (;;) {
+                    collect(batch);
+                    if (batch.empty()) {
+                        if (mClosing && mLanes.empty()) return;
+                        mHasWork.wait(lk);
+                        continue;
+                    }
+                    lk.unlock();
+                    iov.clear();
+                    size_type bytes = 0;
+                    for (auto&& b : batch) {
+                        iov.push_back(iovec {const_cast<char*>(b.data()),
+                            b.size()});
+                        bytes += b.size();
+                    }
+                    bool ok = write_all(iov);
+                    int err = errno;
+                    lk.lock();
+                    if (!ok && !mError) mError = err;
+                    mPending -= bytes;
+                    for (auto&& b : batch)
+                        if (mFree.size() < 64) mFree.push_back(std::move(b));
+                    batch.clear();
+                    mHasRoom.notify_all();
+                }
+            }
+
+        public:
+            /** Writes to @param fd, which is not closed afterwards (e.g. 1
+            *   for stdout). Producers of later lanes wait while more than
+            *   @param max_pending bytes are queued. */
+            explicit output_writer(int fd, size_type max_pending = 64 << 20)
+            : mFd(fd), mOwnsFd(false), mMaxPending(max_pending),
+              mWriter(&output_writer::run, this) {}
+
+            /** Creates or truncates the file at @param path.
+            *   @throw std::system_error if it cannot be opened. */
+            explicit output_writer(const std::string& path,
+                size_type max_pending = 64 << 20)
+            : mFd(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)),
+              mOwnsFd(true), mMaxPending(max_pending)
+            {
+                if (mFd < 0)
+                    throw std::system_error(errno, std::generic_category(),
+                        "open " + path);
+                mWriter = std::thread(&output_writer::run, this);
+            }
+
+            output_writer(const output_writer&) = delete;
+            output_writer& operator=(const output_writer&) = delete;
+
+            ~output_writer() {
+                try { close(); } catch (std::system_error&) {}
+            }
+
+            /** @return: lane @param index, for one thread to write to. Its
+            *   text follows every lower-numbered lane's in the output. */
+            lane open_lane(size_type index) { return lane(this, index); }
+
+            /** Waits until everything handed over has been written; any lane
+            *   still open must already be closed.
+            *   @throw std::system_error if a write failed. */
+            void close() {
+                if (!mWriter.joinable()) return;
+                {
+                    LGuard lk(mMut);
+                    mClosing = true;
+                    mHasWork.notify_one();
+                }
+                mWriter.join();
+                if (mOwnsFd) ::close(mFd);
+                if (mError)
+                    throw std::system_error(mError, std::generic_category(),
+                        "write");
+            }
+        };
+    }
+}
+
+#endif /* output_writer_hpp */
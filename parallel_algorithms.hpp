@@ -0,0 +1,446 @@
+//
+//  parallel_algorithms.hpp
+//  thread_support
+//
+//*  parallel_for, parallel_transform, parallel_reduce and parallel_sort on
+//*  a shared work-stealing pool. Each thread of a task_pool has its own
+//*  deque of tasks: it pushes and pops at the back, so it works depth
+//*  first on what it split off most recently, while idle threads steal
+//*  from the front, taking the oldest and so largest pieces. Ranges are
+//*  split lazily (Tzannes et al., "Lazy Binary Splitting", PPoPP 2010):
+//*  a thread works through its range a grain at a time, and only halves
+//*  what is left when its own deque has run empty, which is when another
+//*  thread may be looking for work. So the split adapts to the load: a
+//*  balanced loop is cut into a few pieces per thread, and an unbalanced
+//*  one keeps being cut where the work turns out to be. The first exception
+//*  thrown by a task cancels the tasks of its group not yet started, and is
+//*  rethrown to the caller once the others have finished.
+//*  Compile with -std=c++17 or higher.
+
+#ifndef parallel_algorithms_hpp
+#define parallel_algorithms_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>  // std::function, std::less
+#include <iterator>
+#include <memory>      // std::unique_ptr
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace david {
+    namespace thread {
+        /** A fixed set of worker threads with a task deque each, plus one
+        *   deque shared by every thread from outside the pool. Threads
+        *   waiting on a task_group run tasks meanwhile, so a pool with no
+        *   workers at all still runs everything, on the waiting thread. */
+        class task_pool {
+        public:
+            using task = std::function<void()>;
+        private:
+            struct alignas(64) slot {
+                std::mutex mut;
+                std::deque<task> tasks;
+                std::atomic<std::size_t> size {0};
+            };
+
+            std::unique_ptr<slot[]> mSlots;    // [0] for outside threads
+            unsigned mSlotCount;
+            std::vector<std::thread> mWorkers;
+            std::mutex mSleepMut;
+            std::condition_variable mWake;
+            std::atomic<unsigned> mSleeping {0};
+            std::atomic<std::uint64_t> mPushes {0};
+            bool mStop = false;                // guarded by mSleepMut
+            //* Convenience typedefs
+            using LGuard = std::lock_guard<std::mutex>;
+            using ULock = std::unique_lock<std::mutex>;
+
+            //* Which pool and slot the current thread works in, if any.
+            struct membership {
+                const task_pool* pool = nullptr;
+                unsigned index = 0;
+            };
+            static membership& current() {
+                static thread_local membership m;
+                return m;
+            }
+
+            unsigned my_slot() const {
+                auto&& m = current();
+                return m.pool == this ? m.index : 0;
+            }
+
+            bool pop(unsigned s, task& t, bool back) {
+                auto&& sl = mSlots[s];
+                if (sl.size.load(std::memory_order_relaxed) == 0) return false;
+                LGuard lk(sl.mut);
+                if (sl.tasks.empty()) return false;
+                if (back) {
+                    t = std::move(sl.tasks.back());
+                    sl.tasks.pop_back();
+                } else {
+                    t = std::move(sl.tasks.front());
+                    sl.tasks.pop_front();
+                }
+                sl.size.store(sl.tasks.size(), std::memory_order_relaxed);
+                return true;
+            }
+
+            void work(unsigned index) {
+                current() = membership {this, index};
+                for (;;) {
+                    std::uint64_t seen = mPushes.load();
+                    if (run_one()) continue;
+                    ULock lk(mSleepMut);
+                    ++mSleeping;
+                    mWake.wait(lk, [&]() {
+                        return mStop || mPushes.load() != seen;
+                    });
+                    --mSleeping;
+                    if (mStop) return;
+                }
+            }
+
+        public:
+            /** Starts @param workers threads; callers waiting on their
+            *   tasks make one more. */
+            explicit task_pool(unsigned workers)
+            : mSlots(new slot[workers + 1]), mSlotCount(workers + 1)
+            {
+                mWorkers.reserve(workers);
+                for (unsigned w = 1; w <= workers; ++w)
+                    mWorkers.emplace_back(&task_pool::work, this, w);
+            }
+
+            task_pool(const task_pool&) = delete;
+            task_pool& operator=(const task_pool&) = delete;
+
+            //* Stops and joins the workers; no tasks may be outstanding.
+            ~task_pool() {
+                {
+                    LGuard lk(mSleepMut);
+                    mStop = true;
+                }
+                mWake.notify_all();
+                for (auto&& th : mWorkers) th.join();
+            }
+
+            /** The process-wide pool: a worker per hardware thread but
+            *   one, the one being the thread that waits. */
+            static task_pool& shared() {
+                static task_pool pool ([]() {
+                    unsigned hwc = std::thread::hardware_concurrency();
+                    return hwc ? hwc - 1 : 3;
+                }());
+                return pool;
+            }
+
+            //* @return: how many threads can run tasks at once.
+            unsigned concurrency() const noexcept { return mSlotCount; }
+
+            //* Queues @param t on the current thread's deque.
+            void push(task t) {
+                auto&& sl = mSlots[my_slot()];
+                {
+                    LGuard lk(sl.mut);
+                    sl.tasks.push_back(std::move(t));
+                    sl.size.store(sl.tasks.size(), std::memory_order_relaxed);
+                }
+                mPushes.fetch_add(1);
+                if (mSleeping.load()) {
+                    LGuard lk(mSleepMut);
+                    mWake.notify_one();
+                }
+            }
+
+            /** Runs one task: the newest of this thread's own, or else the
+            *   oldest of another's. @return: whether there was one. */
+            bool run_one() {
+                unsigned me = my_slot();
+                task t;
+                bool found = pop(me, t, true);
+                for (unsigned i = 1; !found && i < mSlotCount; ++i)
+                    found = pop((me + i) % mSlotCount, t, false);
+                if (found) t();
+                return found;
+            }
+
+            /** Runs tasks until @param done() holds, sleeping while there
+            *   are none to run. Whoever makes done() hold must then call
+            *   notify_done(), or a sleeping caller may not see it. */
+            template <class Done>
+            void run_until(Done done) {
+                while (!done()) {
+                    std::uint64_t seen = mPushes.load();
+                    if (run_one()) continue;
+                    ULock lk(mSleepMut);
+                    ++mSleeping;
+                    mWake.wait(lk, [&]() {
+                        return done() || mPushes.load() != seen;
+                    });
+                    --mSleeping;
+                }
+            }
+
+            //* Wakes the threads in run_until() to check their condition.
+            void notify_done() {
+                if (mSleeping.load()) {
+                    LGuard lk(mSleepMut);
+                    mWake.notify_all();
+                }
+            }
+
+            /** @return: whether a task split off now might be taken by an
+            *   idle thread: there are other threads, and the current one
+            *   has nothing queued for them. */
+            bool wants_work() const {
+                return mSlotCount > 1 && mSlots[my_slot()].size.load(
+                    std::memory_order_relaxed) == 0;
+            }
+        };
+
+        /** Tasks run on a task_pool and waited for together. The first
+        *   exception thrown by one of them is kept for wait() to rethrow,
+        *   and tasks not yet started when it is thrown are skipped. */
+        class task_group {
+            task_pool& mPool;
+            std::atomic<std::size_t> mPending {0};
+            std::atomic<bool> mCancelled {false};
+            std::exception_ptr mError;   // set once, before mCancelled
+            std::mutex mErrorMut;
+            //* Convenience typedefs
+            using LGuard = std::lock_guard<std::mutex>;
+
+        public:
+            explicit task_group(task_pool& pool = task_pool::shared())
+            : mPool(pool) {}
+            task_group(const task_group&) = delete;
+            task_group& operator=(const task_group&) = delete;
+
+            //* Waits for the tasks still running; their errors are dropped.
+            ~task_group() {
+                try { wait(); } catch (...) {}
+            }
+
+            task_pool& pool() const noexcept { return mPool; }
+
+            bool cancelled() const noexcept {
+                return mCancelled.load(std::memory_order_acquire);
+            }
+
+            //* Records the exception being handled, unless one already was.
+            void fail() noexcept {
+                LGuard lk(mErrorMut);
+                if (mError) return;
+                mError = std::current_exception();
+                mCancelled.store(true, std::memory_order_release);
+            }
+
+            //* Queues @param fn() to run on the pool.
+            template <class Fn>
+            void run(Fn fn) {
+                mPending.fetch_add(1, std::memory_order_relaxed);
+                try {
+                    mPool.push([this, fn]() mutable {
+                        if (!cancelled()) {
+                            try { fn(); } catch (...) { fail(); }
+                        }
+                        // the group may be gone once the last task is done
+                        task_pool& pool = mPool;
+                        if (mPending.fetch_sub(1) == 1) pool.notify_done();
+                    });
+                } catch (...) {
+                    mPending.fetch_sub(1, std::memory_order_relaxed);
+                    throw;
+                }
+            }
+
+            /** Runs tasks until every task of this group is done, sleeping
+            *   while the last of them run on other threads.
+            *   @throw the first exception one of them threw */
+            void wait() {
+                mPool.run_until([this]() { return mPending.load() == 0; });
+                if (mError) {
+                    std::exception_ptr e;
+                    std::swap(e, mError);
+                    std::rethrow_exception(e);
+                }
+            }
+        };
+
+        namespace detail {
+            /*  Lazy binary splitting of [lo, hi): a grain at a time, with the
+            *   upper half handed to @g whenever the pool wants work. */
+            template <typename Index, class Fn>
+            void split_range(task_group& g, Index lo, Index hi, Index grain,
+                const Fn& fn)
+            {
+                while (hi - lo > grain) {
+                    if (g.cancelled()) return;
+                    if (g.pool().wants_work() && hi - lo >= 2 * grain) {
+                        Index mid = lo + (hi - lo) / 2;
+                        g.run([&g, mid, hi, grain, &fn]() {
+                            split_range(g, mid, hi, grain, fn);
+                        });
+                        hi = mid;
+                    } else {
+                        fn(lo, Index(lo + grain));
+                        lo += grain;
+                    }
+                }
+                if (lo != hi && !g.cancelled()) fn(lo, hi);
+            }
+
+            //* A grain giving each thread a few dozen pieces of [0, n).
+            template <typename Index>
+            Index auto_grain(Index n, const task_pool& pool) {
+                Index g = Index(n / (Index(32) * pool.concurrency()));
+                return g ? g : Index(1);
+            }
+        }
+
+        /** Calls @param fn(lo, hi) on blocks that cover [first, last)
+        *   exactly once between them, in parallel. Blocks are at least
+        *   @param grain long (but for the last), and 0 picks a grain.
+        *   @throw the first exception fn threw, once all calls are over */
+        template <typename Index, class Fn>
+        void parallel_for_blocks(Index first, Index last, Fn fn,
+            Index grain = 0, task_pool& pool = task_pool::shared())
+        {
+            static_assert(std::is_integral<Index>::value,
+                "parallel_for_blocks takes a range of integers");
+            if (!(first < last)) return;
+            if (grain == 0) grain = detail::auto_grain(Index(last - first),
+                pool);
+            task_group g (pool);
+            try { detail::split_range(g, first, last, grain, fn); }
+            catch (...) { g.fail(); }
+            g.wait();
+        }
+
+        /** Calls @param fn(i) for every i in [first, last), in parallel.
+        *   @throw the first exception fn threw, once all calls are over */
+        template <typename Index, class Fn>
+        void parallel_for(Index first, Index last, Fn fn, Index grain = 0,
+            task_pool& pool = task_pool::shared())
+        {
+            parallel_for_blocks(first, last, [&fn](Index lo, Index hi) {
+                for (Index i = lo; i != hi; ++i) fn(i);
+            }, grain, pool);
+        }
+
+        /** Writes @param fn(x) for every x of [first, last) to the range
+        *   starting at @param out. The iterators must be random access.
+        *   @return: the end of the output */
+        template <class InIt, class OutIt, class Fn>
+        OutIt parallel_transform(InIt first, InIt last, OutIt out, Fn fn,
+            std::size_t grain = 0, task_pool& pool = task_pool::shared())
+        {
+            std::size_t n = std::distance(first, last);
+            parallel_for_blocks(std::size_t(0), n,
+                [&](std::size_t lo, std::size_t hi) {
+                    std::transform(first + lo, first + hi, out + lo, fn);
+                }, grain, pool);
+            return out + n;
+        }
+
+        /** Folds [first, last) with @param op, starting from @param init.
+        *   The range is cut into blocks of @param grain (0 picks a size),
+        *   each block is folded in parallel, and the block results are then
+        *   folded in order: so the grouping depends only on the grain,
+        *   never on the scheduling, and a floating-point sum comes out the
+        *   same every run. @param op must be associative.
+        *   @return: the fold */
+        template <class It, typename T, class BinaryOp>
+        T parallel_reduce(It first, It last, T init, BinaryOp op,
+            std::size_t grain = 0, task_pool& pool = task_pool::shared())
+        {
+            std::size_t n = std::distance(first, last);
+            if (n == 0) return init;
+            if (grain == 0) grain = detail::auto_grain(n, pool);
+            std::size_t blocks = (n + grain - 1) / grain;
+            std::vector<T> partial (blocks, init);
+            parallel_for(std::size_t(0), blocks, [&](std::size_t b) {
+                It lo = first + b * grain;
+                It hi = first + std::min(n, (b + 1) * grain);
+                T acc = *lo;
+                while (++lo != hi) acc = op(acc, *lo);
+                partial[b] = acc;
+            }, std::size_t(1), pool);
+            for (auto&& p : partial) init = op(init, p);
+            return init;
+        }
+
+        namespace detail {
+            //* Below this many elements, std::sort does better alone.
+            constexpr std::ptrdiff_t sort_grain = 1 << 14;
+
+            template <class It, class Compare>
+            void quick_sort(task_group& g, It first, It last, Compare comp,
+                int depth)
+            {
+                while (last - first > sort_grain && depth-- > 0) {
+                    if (g.cancelled()) return;
+                    It mid = first + (last - first) / 2;
+                    auto pivot = *mid;   // median of three
+                    if (comp(*first, pivot)) {
+                        if (comp(*(last - 1), pivot))
+                            pivot = comp(*first, *(last - 1)) ? *(last - 1)
+                                : *first;
+                    } else if (comp(pivot, *(last - 1))) {
+                        pivot = comp(*first, *(last - 1)) ? *first
+                            : *(last - 1);
+                    }
+                    // [first, lt) < pivot, [lt, ge) == pivot, [ge, last) >
+                    It lt = std::partition(first, last,
+                        [&](const auto& x) { return comp(x, pivot); });
+                    It ge = std::partition(lt, last,
+                        [&](const auto& x) { return !comp(pivot, x); });
+                    // hand off the smaller side, go on with the larger
+                    if (lt - first < last - ge) {
+                        g.run([&g, first, lt, comp, depth]() {
+                            quick_sort(g, first, lt, comp, depth);
+                        });
+                        first = ge;
+                    } else {
+                        g.run([&g, ge, last, comp, depth]() {
+                            quick_sort(g, ge, last, comp, depth);
+                        });
+                        last = lt;
+                    }
+                }
+                if (!g.cancelled()) std::sort(first, last, comp);
+            }
+        }
+
+        /** Sorts [first, last), random access, by @param comp: a parallel
+        *   quicksort, which leaves pieces under detail::sort_grain, or any
+        *   that has been cut too many times, to std::sort. Not stable. */
+        template <class It, class Compare = std::less<> >
+        void parallel_sort(It first, It last, Compare comp = Compare(),
+            task_pool& pool = task_pool::shared())
+        {
+            std::ptrdiff_t n = last - first;
+            if (n <= detail::sort_grain || pool.concurrency() == 1) {
+                std::sort(first, last, comp);
+                return;
+            }
+            int depth = 0;
+            for (std::ptrdiff_t m = n; m > 1; m >>= 1) depth += 2;
+            task_group g (pool);
+            try { detail::quick_sort(g, first, last, comp, depth); }
+            catch (...) { g.fail(); }
+            g.wait();
+        }
+    }
+}
+
+#endif /* parallel_algorithms_hpp */
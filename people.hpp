@@ -0,0 +1,315 @@
+//
+//  people.hpp
+//  thread_support
+//
+//  Compact record layout for the people files read by the age sorter.
+//
+//*  A Person is an age packed into one 32-bit sort key plus two interned
+//*  name IDs. Records live in a per-file arena; the priority queue only ever
+//*  holds (key, index) pairs, so a heap sift moves 8 bytes instead of a
+//*  std::string.
+
+#ifndef people_hpp
+#define people_hpp
+
+#include <cstdint>
+#include <cstring>      // std::memcpy, std::memcmp
+#include <string>
+#include <string_view>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex> // std::shared_timed_mutex
+#include <stdexcept>
+#include <ostream>
+#include "mapped_file.hpp"
+
+namespace david {
+    namespace people {
+        using age_key = std::uint32_t;
+        using name_id = std::uint16_t;
+
+        /** Packs an age into a key whose unsigned ordering is the ordering
+        *   of (years, months, days). */
+        constexpr age_key pack_age(unsigned short years, unsigned char months,
+            unsigned char days) noexcept
+        {
+            return age_key(years) << 16 | age_key(months) << 8 | days;
+        }
+
+        constexpr unsigned short years (age_key k) noexcept {
+            return static_cast<unsigned short>(k >> 16);
+        }
+        constexpr unsigned char  months(age_key k) noexcept {
+            return static_cast<unsigned char>(k >> 8);
+        }
+        constexpr unsigned char  days  (age_key k) noexcept {
+            return static_cast<unsigned char>(k);
+        }
+
+        /** Thread-safe string interning table. Any number of reader threads
+        *   may intern names while another thread looks them up. Strings are
+        *   kept in a std::deque, so references stay valid as it grows, and
+        *   the index is keyed on views of those strings, so a lookup never
+        *   allocates. */
+        class name_table {
+            std::deque<std::string> mNames;
+            std::unordered_map<std::string_view, name_id> mIds;
+            mutable std::shared_timed_mutex mMut;
+            using SLock = std::shared_lock<std::shared_timed_mutex>;
+            using XLock = std::unique_lock<std::shared_timed_mutex>;
+        public:
+            /** @return: the ID of @param name, adding it if it is new.
+            *   @throw std::length_error if the table runs out of IDs. */
+            name_id intern(std::string_view name) {
+                {
+                    SLock lk(mMut);
+                    auto it = mIds.find(name);
+                    if (it != mIds.end()) return it->second;
+                }
+                XLock lk(mMut);
+                auto it = mIds.find(name); // someone may have beaten us here
+                if (it != mIds.end()) return it->second;
+                if (mNames.size() > name_id(-1))
+                    throw std::length_error("name_table is full.");
+                name_id id = static_cast<name_id>(mNames.size());
+                mNames.emplace_back(name);
+                mIds.emplace(mNames.back(), id);
+                return id;
+            }
+
+            /** @return: the string interned as @param id */
+            const std::string& operator[](name_id id) const {
+                SLock lk(mMut);
+                return mNames[id];
+            }
+
+            std::size_t size() const {
+                SLock lk(mMut);
+                return mNames.size();
+            }
+
+            /** @return: a copy of every name, indexable by name_id without
+            *   taking the lock per lookup. */
+            std::vector<std::string> snapshot() const {
+                SLock lk(mMut);
+                return std::vector<std::string>(mNames.begin(), mNames.end());
+            }
+        };
+
+        /** Per-thread front for a name_table: remembers the IDs it has
+        *   already seen, keyed on views into the caller's input, so parsing
+        *   only takes the table's lock the first time each name appears.
+        *   The views must outlive the cache. */
+        class name_cache {
+            name_table& mTable;
+            std::unordered_map<std::string_view, name_id> mSeen;
+        public:
+            explicit name_cache(name_table& table) : mTable(table) {}
+            name_id operator()(std::string_view name) {
+                auto it = mSeen.find(name);
+                if (it != mSeen.end()) return it->second;
+                name_id id = mTable.intern(name);
+                mSeen.emplace(name, id);
+                return id;
+            }
+        };
+
+        //* 8 bytes per person, against ~40 for an age and a std::string.
+        struct person_record {
+            age_key key;
+            name_id first, last;
+        };
+
+        /** Heap element: the sort key, and where to find the rest of the
+        *   record in a person_arena. Among equal ages, the record read first
+        *   has priority, so the online sort is stable per input file. */
+        struct heap_entry {
+            age_key       key;
+            std::uint32_t index;
+        };
+
+        inline bool operator< (const heap_entry& a, const heap_entry& b) {
+            return a.key < b.key || (a.key == b.key && a.index > b.index);
+        }
+
+        /** Arena of person_records, one fixed-size block per input source.
+        *   Each block is sized once, by one owning thread, before any of
+        *   its indices are published, so readers of published indices
+        *   never race with a reallocation.
+        *   An index packs the source in its top source_bits bits. */
+        class person_arena {
+        public:
+            static constexpr unsigned source_bits = 5;  // up to 31 files
+            static constexpr unsigned row_bits    = 32 - source_bits;
+            static constexpr std::uint32_t max_rows = 1u << row_bits;
+
+        private:
+            std::vector<std::vector<person_record>> mBlocks;
+
+        public:
+            explicit person_arena(unsigned sources = 0) : mBlocks(sources) {
+                if (sources > (1u << source_bits))
+                    throw std::length_error("person_arena: too many sources.");
+            }
+
+            /** Sizes the block for @param source to @param rows records.
+            *   Must be called by the owning thread before publishing. */
+            std::vector<person_record>& allocate(unsigned source,
+                std::size_t rows)
+            {
+                if (rows > max_rows)
+                    throw std::length_error("person_arena: source too large.");
+                mBlocks[source].resize(rows);
+                return mBlocks[source];
+            }
+
+            static constexpr std::uint32_t index(unsigned source, unsigned row)
+            {
+                return std::uint32_t(source) << row_bits | row;
+            }
+
+            const person_record& operator[](std::uint32_t idx) const {
+                return mBlocks[idx >> row_bits][idx & (max_rows - 1)];
+            }
+
+            std::size_t sources() const noexcept { return mBlocks.size(); }
+            std::vector<person_record>& block(unsigned source) {
+                return mBlocks[source];
+            }
+            const std::vector<person_record>& block(unsigned source) const {
+                return mBlocks[source];
+            }
+        };
+
+        //* The shortest line parse_person accepts: "0 0 0 a b\n".
+        constexpr std::size_t min_person_line = 10;
+
+        /** Parses one "Y M D\tFirst Last" line at @param p, advancing @param p
+        *   to the start of the next line either way.
+        *   @return: whether @param r was filled in. */
+        inline bool parse_person(const char*& p, const char* last,
+            person_record& r, name_cache& names)
+        {
+            const char* line = p;
+            unsigned short y; unsigned char m, d;
+            p = io::next_line(p, last);
+            if (!(io::parse_int(line, p, y) && io::parse_int(line, p, m)
+                && io::parse_int(line, p, d)))
+                return false;
+            auto first = io::parse_word(line, p);
+            auto second = io::parse_word(line, p);
+            if (first.empty() || second.empty()) return false;
+            r = person_record {pack_age(y, m, d), names(first), names(second)};
+            return true;
+        }
+
+        /** Writes @param r in the age sorter's output format,
+        *   "First Last;\tY M D", to an std::ostream or to a formatter from
+        *   output_writer.hpp. @param names maps a name_id to its name: a
+        *   name_table, or a snapshot() of one. */
+        template <class Out, class Names>
+        inline Out& write_person(Out& o, const person_record& r,
+            const Names& names)
+        {
+            o << names[r.first] << ' ' << names[r.last] << ";\t"
+                << years(r.key) << ' ' << unsigned(months(r.key)) << ' '
+                << unsigned(days(r.key));
+            return o;
+        }
+
+        /*  Binary people files, written by make_people -b. Layout (native
+        *   little-endian):
+        *       header   64 bytes, see people_file_header
+        *       names    name_count names, each ended by a newline
+        *       records  person_record[record_count], 64-byte aligned, whose
+        *                name IDs index the names above */
+        constexpr char          people_file_magic[8] = "DPEOPLE";
+        constexpr std::uint32_t people_file_version  = 1;
+
+        struct people_file_header {
+            char          magic[8];       // people_file_magic
+            std::uint32_t version;        // people_file_version
+            std::uint32_t name_count;
+            std::uint64_t record_count;
+            std::uint64_t names_offset,   // byte offsets from the file's start
+                          records_offset;
+            std::uint64_t reserved[3];
+        };
+        static_assert(sizeof(people_file_header) == 64,
+            "the header is one cache line");
+        static_assert(sizeof(person_record) == 8,
+            "person_record is written to files as is");
+
+        inline bool is_people_file(const io::mapped_file& file) noexcept {
+            return file.size() >= sizeof(people_file_header)
+                && std::memcmp(file.begin(), people_file_magic,
+                    sizeof people_file_magic) == 0;
+        }
+
+        /** @return: the header and names of a people file holding
+        *   @param records records; the records follow straight after. */
+        inline std::string people_file_prefix(
+            const std::vector<std::string>& names, std::uint64_t records)
+        {
+            people_file_header h {};
+            std::memcpy(h.magic, people_file_magic, sizeof h.magic);
+            h.version = people_file_version;
+            h.name_count = std::uint32_t(names.size());
+            h.record_count = records;
+            h.names_offset = sizeof h;
+            std::string prefix (sizeof h, '\0');
+            for (auto&& n : names) { prefix += n; prefix += '\n'; }
+            prefix.resize((prefix.size() + 63) / 64 * 64, '\0');
+            h.records_offset = prefix.size();
+            std::memcpy(&prefix[0], &h, sizeof h);
+            return prefix;
+        }
+
+        /** A view of a mapped people file, which must outlive it. */
+        class people_file {
+            const person_record* mRecords = nullptr;
+            std::uint64_t mCount = 0;
+            std::vector<std::string_view> mNames;
+        public:
+            /** @throw std::runtime_error if @param file is not a people
+            *   file of a version we can read. */
+            explicit people_file(const io::mapped_file& file) {
+                people_file_header h;
+                if (!is_people_file(file))
+                    throw std::runtime_error("not a people file");
+                std::memcpy(&h, file.begin(), sizeof h);
+                if (h.version != people_file_version)
+                    throw std::runtime_error("unsupported people file version");
+                if (h.records_offset % alignof(person_record) != 0
+                    || h.records_offset > file.size()
+                    || h.record_count > (file.size() - h.records_offset)
+                        / sizeof(person_record)
+                    || h.names_offset > h.records_offset)
+                    throw std::runtime_error("truncated people file");
+                const char* p = file.begin() + h.names_offset;
+                const char* last = file.begin() + h.records_offset;
+                mNames.reserve(h.name_count);
+                for (std::uint32_t i = 0; i < h.name_count; ++i) {
+                    const char* e = io::next_line(p, last);
+                    if (e == p || e[-1] != '\n')
+                        throw std::runtime_error("truncated people file");
+                    mNames.emplace_back(p, e - p - 1);
+                    p = e;
+                }
+                mRecords = reinterpret_cast<const person_record*>(
+                    file.begin() + h.records_offset);
+                mCount = h.record_count;
+            }
+
+            std::size_t size() const noexcept { return mCount; }
+            const person_record* records() const noexcept { return mRecords; }
+            const std::vector<std::string_view>& names() const noexcept {
+                return mNames;
+            }
+        };
+    }
+}
+
+#endif /* people_hpp */
@@ -0,0 +1,342 @@
+//
+//  perf_counters.hpp
+//  thread_support
+//
+//*  Hardware and software event counts for a region of code, read in
+//*  process through Linux's perf_event_open: cycles, instructions, cache
+//*  misses, last-level cache (read) misses, branch mispredictions and
+//*  context switches. A region gathers the counts of every scope opened on
+//*  it, per thread and in total, with the operations each scope did, and
+//*  reports them per operation, so a slow variant can be told apart as
+//*  stalling on memory (false sharing, allocation) or on the scheduler.
+//*  Each thread opens its own counters on first use and keeps them. A
+//*  region made with children == true uses a second set that inherits, so
+//*  that threads started and joined inside its scopes, like the workers of
+//*  a task_pool made for the scope, are counted in them too (the kernel
+//*  folds a thread's counts into its parent's as it exits). Threads that
+//*  outlive a scope, like the shared pool's, need scopes of their own on a
+//*  plain region.
+//*  A counter that cannot be opened (no PMU in a VM, perf_event_paranoid,
+//*  not Linux) is left out, and reported as "-"; a scope on a region that
+//*  is not enabled costs a branch.
+
+#ifndef perf_counters_hpp
+#define perf_counters_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <iomanip>
+#include <algorithm> // std::sort
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace david {
+    namespace thread {
+        namespace perf {
+            //* The events counted, in report order.
+            enum event : unsigned {
+                cycles, instructions, cache_misses, llc_misses,
+                branch_misses, context_switches, event_count
+            };
+
+            inline const char* event_name(unsigned e) {
+                static const char* const names[event_count] = {
+                    "cycles", "instr", "cache-miss", "LLC-miss",
+                    "br-miss", "ctx-sw"
+                };
+                return names[e];
+            }
+
+            /** Counts of every event over some stretch, with the operations
+            *   done in it. A count is valid only if its counter was open
+            *   and running throughout; if the kernel multiplexed it, it is
+            *   scaled up by the share of the time it was running. */
+            struct sample {
+                double value[event_count] = {};
+                bool valid[event_count] = {};
+                std::uint64_t ops = 0;
+
+                sample& operator+=(const sample& s) {
+                    for (unsigned e = 0; e < event_count; ++e) {
+                        value[e] += s.value[e];
+                        // a total is valid if any part was
+                        valid[e] = valid[e] || s.valid[e];
+                    }
+                    ops += s.ops;
+                    return *this;
+                }
+            };
+
+            /** The calling thread's counters, one file descriptor per event
+            *   (not a group, so one that fails to open leaves the others).
+            *   Counting starts when they are opened; a scope is the
+            *   difference of two reads. */
+            class thread_counters {
+            public:
+                //* A counter's raw value and its enabled and running times.
+                struct raw {
+                    std::uint64_t value = 0, enabled = 0, running = 0;
+                };
+                struct reading { raw r[event_count]; };
+
+                explicit thread_counters(bool children) {
+                    for (unsigned e = 0; e < event_count; ++e)
+                        mFd[e] = open(e, children);
+                }
+                ~thread_counters() {
+#ifdef __linux__
+                    for (int fd : mFd) if (fd >= 0) ::close(fd);
+#endif
+                }
+                thread_counters(const thread_counters&) = delete;
+                thread_counters& operator=(const thread_counters&) = delete;
+
+                /** @return: this thread's counters, opened on first use;
+                *   with @param children, the set that inherits. */
+                static thread_counters& local(bool children) {
+                    if (children) {
+                        thread_local thread_counters inheriting (true);
+                        return inheriting;
+                    }
+                    thread_local thread_counters own (false);
+                    return own;
+                }
+
+                bool available(unsigned e) const { return mFd[e] >= 0; }
+
+                /** @return: a number for the calling thread, unique in the
+                *   process (std::thread::id may be reused once joined). */
+                static unsigned thread_index() {
+                    static std::atomic<unsigned> next {0};
+                    thread_local unsigned index = next++;
+                    return index;
+                }
+
+                reading read() const {
+                    reading now;
+#ifdef __linux__
+                    for (unsigned e = 0; e < event_count; ++e) {
+                        std::uint64_t buf[3];
+                        if (mFd[e] < 0
+                            || ::read(mFd[e], buf, sizeof buf) != sizeof buf)
+                            continue;
+                        now.r[e].value = buf[0];
+                        now.r[e].enabled = buf[1];
+                        now.r[e].running = buf[2];
+                    }
+#endif
+                    return now;
+                }
+
+                //* @return: the counts between readings @param a and @param b.
+                sample difference(const reading& a, const reading& b) const {
+                    sample s;
+                    for (unsigned e = 0; e < event_count; ++e) {
+                        std::uint64_t run = b.r[e].running - a.r[e].running;
+                        std::uint64_t en = b.r[e].enabled - a.r[e].enabled;
+                        if (!available(e) || (en && !run)) continue;
+                        double v = double(b.r[e].value - a.r[e].value);
+                        s.value[e] = run < en ? v * en / run : v;
+                        s.valid[e] = true;
+                    }
+                    return s;
+                }
+
+            private:
+                int mFd[event_count];
+
+                //* @return: a descriptor counting @param e, or -1.
+                static int open(unsigned e, bool children) {
+#ifdef __linux__
+                    perf_event_attr attr;
+                    std::memset(&attr, 0, sizeof attr);
+                    attr.size = sizeof attr;
+                    attr.type = PERF_TYPE_HARDWARE;
+                    switch (e) {
+                    case cycles:
+                        attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+                    case instructions:
+                        attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+                    case cache_misses:
+                        attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+                    case llc_misses:
+                        attr.type = PERF_TYPE_HW_CACHE;
+                        attr.config = PERF_COUNT_HW_CACHE_LL
+                            | PERF_COUNT_HW_CACHE_OP_READ << 8
+                            | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+                        break;
+                    case branch_misses:
+                        attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+                    default:
+                        attr.type = PERF_TYPE_SOFTWARE;
+                        attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+                    }
+                    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+                        | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                    attr.inherit = children;
+                    attr.exclude_hv = 1;
+                    // with perf_event_paranoid >= 2, only user space may be
+                    // counted; context switches are only seen by the kernel
+                    for (int user_only = 0; user_only < 2; ++user_only) {
+                        attr.exclude_kernel = user_only;
+                        int fd = int(syscall(__NR_perf_event_open, &attr, 0,
+                            -1, -1, 0));
+                        if (fd >= 0) return fd;
+                    }
+#else
+                    (void)e; (void)children;
+#endif
+                    return -1;
+                }
+            };
+
+            /** A named region of code. Scopes add their counts to it, per
+            *   thread, under a mutex; report() prints them per operation.
+            *   A region that is not enabled ignores its scopes. */
+            class region {
+            public:
+                explicit region(std::string name, bool enabled = true,
+                    bool children = false)
+                : mName(std::move(name)), mEnabled(enabled),
+                    mChildren(children) {}
+
+                //* Whether scopes count the threads they start and join.
+                bool children() const { return mChildren; }
+
+                bool enabled() const {
+                    return mEnabled.load(std::memory_order_relaxed);
+                }
+                void enable(bool on = true) {
+                    mEnabled.store(on, std::memory_order_relaxed);
+                }
+
+                //* Adds @param s to the total of thread @param id.
+                void add(unsigned id, const sample& s) {
+                    LGuard lk(mMut);
+                    for (auto&& t : mThreads)
+                        if (t.id == id) { t.counts += s; return; }
+                    mThreads.push_back(per_thread {id, s});
+                }
+
+                //* @return: the counts of every thread so far, summed.
+                sample total() const {
+                    LGuard lk(mMut);
+                    sample sum;
+                    for (auto&& t : mThreads) sum += t.counts;
+                    return sum;
+                }
+
+                /** Prints a row per thread (numbered in the order they first
+                *   counted anything) and one for all of them: operations,
+                *   then every event per operation, and instructions per
+                *   cycle. Context switches are totals, not per operation. */
+                void report(std::ostream& o) const {
+                    std::vector<per_thread> threads;
+                    {
+                        LGuard lk(mMut);
+                        threads = mThreads;
+                    }
+                    std::sort(threads.begin(), threads.end(),
+                        [](const per_thread& a, const per_thread& b) {
+                            return a.id < b.id;
+                        });
+                    sample sum;
+                    for (auto&& t : threads) sum += t.counts;
+                    o << "perf " << mName << ": " << threads.size()
+                        << " threads, per op" << std::endl
+                        << std::setw(8) << "thread" << std::setw(12) << "ops";
+                    for (unsigned e = 0; e < event_count; ++e)
+                        o << std::setw(12) << event_name(e);
+                    o << std::setw(8) << "IPC" << std::endl;
+                    for (std::size_t i = 0; i < threads.size(); ++i)
+                        row(o, std::to_string(threads[i].id),
+                            threads[i].counts);
+                    if (threads.size() != 1) row(o, "all", sum);
+                }
+
+            private:
+                struct per_thread {
+                    unsigned id;
+                    sample counts;
+                };
+
+                std::string mName;
+                std::atomic<bool> mEnabled;
+                const bool mChildren;
+                mutable std::mutex mMut;
+                std::vector<per_thread> mThreads;
+                //* Convenience typedefs
+                using LGuard = std::lock_guard<std::mutex>;
+
+                static void row(std::ostream& o, const std::string& label,
+                    const sample& s)
+                {
+                    auto flags = o.flags();
+                    auto precision = o.precision();
+                    double per = s.ops ? double(s.ops) : 1.0;
+                    o << std::setw(8) << label << std::setw(12) << s.ops
+                        << std::fixed;
+                    for (unsigned e = 0; e < event_count; ++e) {
+                        o << std::setw(12);
+                        if (!s.valid[e]) o << '-';
+                        else if (e == context_switches)
+                            o << std::setprecision(0) << s.value[e];
+                        else o << std::setprecision(3) << s.value[e] / per;
+                    }
+                    o << std::setw(8);
+                    if (s.valid[cycles] && s.valid[instructions]
+                        && s.value[cycles] > 0)
+                        o << std::setprecision(2)
+                            << s.value[instructions] / s.value[cycles];
+                    else o << '-';
+                    o << std::endl;
+                    o.flags(flags);
+                    o.precision(precision);
+                }
+            };
+
+            /** Counts the calling thread (and the threads it starts and
+            *   joins) from construction to destruction into a region,
+            *   along with @param ops operations, which ops() may set later. */
+            class scope {
+            public:
+                explicit scope(region& r, std::uint64_t ops = 0)
+                : mRegion(r.enabled() ? &r : nullptr), mOps(ops)
+                {
+                    if (mRegion)
+                        mStart = thread_counters::local(r.children()).read();
+                }
+
+                ~scope() {
+                    if (!mRegion) return;
+                    auto&& counters = thread_counters::local(
+                        mRegion->children());
+                    sample s = counters.difference(mStart, counters.read());
+                    s.ops = mOps;
+                    mRegion->add(counters.thread_index(), s);
+                }
+
+                scope(const scope&) = delete;
+                scope& operator=(const scope&) = delete;
+
+                void ops(std::uint64_t n) { mOps = n; }
+
+            private:
+                region* mRegion;
+                std::uint64_t mOps;
+                thread_counters::reading mStart;
+            };
+        }
+    }
+}
+
+#endif /* perf_counters_hpp */
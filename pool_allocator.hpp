@@ -0,0 +1,279 @@
+//
+//  pool_allocator.hpp
+//  thread_support
+//
+//*  A standard allocator drawing from process-wide pools of fixed-size
+//*  blocks, for the node and block allocations that containers make on
+//*  every push and pop. Requests are rounded up to a power-of-two size
+//*  class from 16 bytes to 4 KB; anything bigger goes to operator new.
+//*  Each thread keeps its own free list per class, so most allocations and
+//*  frees touch no lock and no shared cache line. A thread that runs dry
+//*  takes a whole batch of blocks from the class's central pool, and one
+//*  that frees more than two batches' worth (say, the consumer end of a
+//*  queue) hands a batch back, so blocks flow from consumers to producers
+//*  a batch at a time. The pools carve blocks out of 2 MB chunks, mapped
+//*  with huge pages after pool::use_huge_pages(true) where the system has
+//*  them, which spares the TLB when containers are spread over many
+//*  chunks. Chunks are kept for the life of the process.
+//*  Every pool_allocator shares the same pools, so all of them compare
+//*  equal, and memory from one may be freed through any other.
+
+#ifndef pool_allocator_hpp
+#define pool_allocator_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <new>         // std::bad_alloc
+#include <type_traits> // std::true_type
+#include <utility>     // std::pair
+#include <vector>
+#include <sys/mman.h>  // mmap, madvise
+
+namespace david {
+    namespace thread {
+        namespace pool {
+            constexpr std::size_t min_block = 16;
+            constexpr std::size_t max_block = 4096;
+            constexpr std::size_t classes = 9;  // 16, 32, ..., 4096 bytes
+            constexpr std::size_t chunk_bytes = std::size_t(2) << 20;
+
+            //* A free block, linked through its first word.
+            struct free_block { free_block* next; };
+
+            //* @return: the size class of a request of @param bytes.
+            inline std::size_t class_of(std::size_t bytes) noexcept {
+                std::size_t c = 0;
+                for (std::size_t b = min_block; b < bytes; b <<= 1) ++c;
+                return c;
+            }
+
+            inline std::size_t block_size(std::size_t cls) noexcept {
+                return min_block << cls;
+            }
+
+            //* Blocks moved at once between a thread and the central pool.
+            inline std::size_t batch_size(std::size_t cls) noexcept {
+                std::size_t n = (std::size_t(64) << 10) / block_size(cls);
+                return n < 8 ? 8 : n;
+            }
+
+            inline std::atomic<bool>& huge_pages_flag() {
+                static std::atomic<bool> flag {false};
+                return flag;
+            }
+
+            /** Whether chunks mapped from now on should use huge pages:
+            *   explicit ones (MAP_HUGETLB) if any are reserved, or else
+            *   transparent ones, by advice. */
+            inline void use_huge_pages(bool on) {
+                huge_pages_flag().store(on, std::memory_order_relaxed);
+            }
+
+            /*  Maps a fresh chunk. @throw std::bad_alloc if there is no
+            *   memory left. */
+            inline char* map_chunk() {
+                void* p = MAP_FAILED;
+                bool huge = huge_pages_flag().load(std::memory_order_relaxed);
+#ifdef MAP_HUGETLB
+                if (huge)
+                    p = ::mmap(nullptr, chunk_bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+                if (p == MAP_FAILED) {
+                    p = ::mmap(nullptr, chunk_bytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                    if (p == MAP_FAILED) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+                    if (huge) ::madvise(p, chunk_bytes, MADV_HUGEPAGE);
+#endif
+                }
+                return static_cast<char*>(p);
+            }
+
+            /** The shared pool of one size class: whole batches of free
+            *   blocks, and the unused rest of the chunk being carved. */
+            class central_pool {
+                //* A null-terminated chain of free blocks, and its length.
+                using batch = std::pair<free_block*, std::size_t>;
+
+                std::mutex mMut;
+                std::vector<batch> mBatches;
+                char* mCarve = nullptr;
+                char* mCarveEnd = nullptr;
+                std::size_t mBlock = 0;
+                //* Convenience typedefs
+                using LGuard = std::lock_guard<std::mutex>;
+
+            public:
+                void init(std::size_t block) { mBlock = block; }
+
+                /** @return: a chain of up to @param n free blocks, whose
+                *   length is left in @param got (at least 1). */
+                free_block* take(std::size_t n, std::size_t& got) {
+                    LGuard lk(mMut);
+                    if (!mBatches.empty()) {
+                        batch b = mBatches.back();
+                        mBatches.pop_back();
+                        got = b.second;
+                        return b.first;
+                    }
+                    if (mCarve == mCarveEnd) {
+                        mCarve = map_chunk();
+                        mCarveEnd = mCarve + chunk_bytes;
+                    }
+                    std::size_t left = (mCarveEnd - mCarve) / mBlock;
+                    got = n < left ? n : left;
+                    free_block* head = nullptr;
+                    for (std::size_t i = got; i-- > 0; ) {
+                        auto* b = reinterpret_cast<free_block*>(mCarve
+                            + i * mBlock);
+                        b->next = head;
+                        head = b;
+                    }
+                    mCarve += got * mBlock;
+                    return head;
+                }
+
+                //* Takes back the chain at @param head of @param n blocks.
+                void give(free_block* head, std::size_t n) {
+                    LGuard lk(mMut);
+                    mBatches.push_back(batch(head, n));
+                }
+            };
+
+            /*  The central pools, one per class. Never destroyed, so that
+            *   containers destroyed during static destruction can still
+            *   free into them. */
+            inline central_pool* central() {
+                static central_pool* pools = []() {
+                    auto* p = new central_pool[classes];
+                    for (std::size_t c = 0; c < classes; ++c)
+                        p[c].init(block_size(c));
+                    return p;
+                }();
+                return pools;
+            }
+
+            //* A thread's free lists, handed back when the thread exits.
+            struct thread_cache {
+                struct bin {
+                    free_block* head = nullptr;
+                    std::size_t count = 0;
+                };
+                bin bins[classes];
+
+                static bool& alive() {
+                    static thread_local bool flag = false;
+                    return flag;
+                }
+                thread_cache() { alive() = true; }
+                ~thread_cache() {
+                    alive() = false;
+                    for (std::size_t c = 0; c < classes; ++c)
+                        if (bins[c].head)
+                            central()[c].give(bins[c].head, bins[c].count);
+                }
+            };
+
+            /*  This thread's cache, or null once it has been destroyed
+            *   (for frees made by thread_local destructors that run
+            *   after it). */
+            inline thread_cache* local_cache() {
+                static thread_local thread_cache cache;
+                return thread_cache::alive() ? &cache : nullptr;
+            }
+
+            //* @return: a block of size class @param cls.
+            inline void* allocate(std::size_t cls) {
+                thread_cache* tc = local_cache();
+                std::size_t got;
+                if (!tc) {
+                    free_block* b = central()[cls].take(1, got);
+                    if (got > 1) central()[cls].give(b->next, got - 1);
+                    return b;
+                }
+                auto&& bin = tc->bins[cls];
+                if (!bin.head)
+                    bin.head = central()[cls].take(batch_size(cls), bin.count);
+                free_block* b = bin.head;
+                bin.head = b->next;
+                --bin.count;
+                return b;
+            }
+
+            //* Frees @param p, a block of size class @param cls.
+            inline void deallocate(void* p, std::size_t cls) noexcept {
+                auto* b = static_cast<free_block*>(p);
+                thread_cache* tc = local_cache();
+                if (!tc) {
+                    b->next = nullptr;
+                    central()[cls].give(b, 1);
+                    return;
+                }
+                auto&& bin = tc->bins[cls];
+                b->next = bin.head;
+                bin.head = b;
+                std::size_t batch = batch_size(cls);
+                if (++bin.count < 2 * batch) return;
+                // hand the first batch back, keep the rest
+                free_block* last = bin.head;
+                for (std::size_t i = 1; i < batch; ++i) last = last->next;
+                free_block* give = bin.head;
+                bin.head = last->next;
+                last->next = nullptr;
+                bin.count -= batch;
+                central()[cls].give(give, batch);
+            }
+        }
+
+        /** The allocator: fixed-size blocks from the pools above for
+        *   requests of up to pool::max_block bytes, operator new beyond. */
+        template <typename T>
+        class pool_allocator {
+        public:
+            using value_type = T;
+            using size_type = std::size_t;
+            using difference_type = std::ptrdiff_t;
+            using propagate_on_container_move_assignment = std::true_type;
+            using is_always_equal = std::true_type;
+            template <typename U> struct rebind {
+                using other = pool_allocator<U>;
+            };
+
+            pool_allocator() noexcept = default;
+            template <typename U>
+            pool_allocator(const pool_allocator<U>&) noexcept {}
+
+            T* allocate(std::size_t n) {
+                std::size_t bytes = n * sizeof(T);
+                if (bytes > pool::max_block)
+                    return static_cast<T*>(::operator new(bytes));
+                return static_cast<T*>(pool::allocate(pool::class_of(bytes)));
+            }
+
+            void deallocate(T* p, std::size_t n) noexcept {
+                std::size_t bytes = n * sizeof(T);
+                if (bytes > pool::max_block) ::operator delete(p);
+                else pool::deallocate(p, pool::class_of(bytes));
+            }
+
+            template <typename U> bool operator==(
+                const pool_allocator<U>&) const noexcept {
+                return true;
+            }
+            template <typename U> bool operator!=(
+                const pool_allocator<U>&) const noexcept {
+                return false;
+            }
+        };
+
+        //* A deque drawing from the pools, e.g. as thread_queue's Container.
+        template <typename T>
+        using pool_deque = std::deque<T, pool_allocator<T> >;
+    }
+}
+
+#endif /* pool_allocator_hpp */
@@ -0,0 +1,104 @@
+//
+//  radix_sort.hpp
+//  thread_support
+//
+//*  A parallel, stable LSD radix sort on an unsigned 32-bit key, for when
+//*  all of the input is known up front and a priority queue is overkill.
+//*  Its passes run on a task_pool (parallel_algorithms.hpp).
+//*  Compile with -std=c++17 or higher.
+
+#ifndef radix_sort_hpp
+#define radix_sort_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <array>
+#include <algorithm> // std::min
+#include "parallel_algorithms.hpp"
+
+namespace david {
+    namespace thread {
+        namespace detail {
+            /*  Runs fn(t, first, last) over @blocks contiguous blocks of
+            *   [0, n), one task each, on @pool. */
+            template <class Fn>
+            void for_blocks(std::size_t n, unsigned blocks, task_pool& pool,
+                const Fn& fn)
+            {
+                std::size_t per_block = n / blocks;
+                parallel_for(0u, blocks, [&](unsigned t) {
+                    fn(t, t * per_block, t + 1 == blocks ? n
+                        : (t + 1) * per_block);
+                }, 1u, pool);
+            }
+        }
+
+        /** Sorts @param data stably by key(element), ascending, 8 bits per
+        *   pass. The data is cut into a block per thread of @param pool,
+        *   and each task histograms and scatters its own contiguous block;
+        *   the per-(digit, block) offsets keep equal keys in input order.
+        *   A pass whose digit is the same for every element is skipped, so
+        *   small keys cost fewer than four passes.
+        *   @param key: callable returning the std::uint32_t sort key */
+        template <typename T, class Key>
+        void parallel_radix_sort(std::vector<T>& data, Key key,
+            task_pool& pool = task_pool::shared())
+        {
+            constexpr unsigned radix = 256;
+            using histogram = std::array<std::size_t, radix>;
+            const std::size_t n = data.size();
+            if (n < 2) return;
+            // small inputs are not worth splitting
+            unsigned blocks = unsigned(std::min<std::size_t>(
+                pool.concurrency(), 1 + n / 65536));
+
+            std::vector<T> buffer(n);
+            std::vector<T>* src = &data;
+            std::vector<T>* dst = &buffer;
+            std::vector<histogram> counts(blocks);
+
+            for (unsigned shift = 0; shift < 32; shift += 8) {
+                detail::for_blocks(n, blocks, pool, [&](unsigned t,
+                    std::size_t first, std::size_t last)
+                {
+                    histogram& h = counts[t];
+                    h.fill(0);
+                    const T* in = src->data();
+                    for (std::size_t i = first; i < last; ++i)
+                        ++h[(key(in[i]) >> shift) & (radix - 1)];
+                });
+
+                // exclusive prefix sum, digit-major then block-major
+                std::size_t total = 0;
+                bool trivial = false;
+                for (unsigned d = 0; d < radix; ++d) {
+                    std::size_t digit_total = 0;
+                    for (auto&& h : counts) {
+                        std::size_t c = h[d];
+                        h[d] = total + digit_total;
+                        digit_total += c;
+                    }
+                    if (digit_total == n) trivial = true;
+                    total += digit_total;
+                }
+                if (trivial) continue; // every key has this digit
+
+                detail::for_blocks(n, blocks, pool, [&](unsigned t,
+                    std::size_t first, std::size_t last)
+                {
+                    histogram& offset = counts[t];
+                    const T* in = src->data();
+                    T* out = dst->data();
+                    for (std::size_t i = first; i < last; ++i)
+                        out[offset[(key(in[i]) >> shift) & (radix - 1)]++]
+                            = in[i];
+                });
+                std::swap(src, dst);
+            }
+            if (src != &data) data.swap(buffer);
+        }
+    }
+}
+
+#endif /* radix_sort_hpp */
@@ -0,0 +1,255 @@
+//
+//  rcu.hpp
+//  thread_support
+//
+//*  Read-copy-update for read-mostly data, after the "memb" flavour of
+//*  userspace RCU (Desnoyers et al., IEEE TPDS 2012). A snapshot<T> holds a
+//*  pointer to an immutable T. Readers take a reader, which pins whatever
+//*  T is current for as long as they hold it; writers publish a whole new
+//*  T and free the old one after a grace period, once every reader that
+//*  could have seen it has let go.
+//*  Entering and leaving a read-side section is a plain load and store to
+//*  the thread's own record, with no atomic read-modify-write and, on
+//*  Linux, no fence either: the writer pays for both sides with the
+//*  membarrier system call, which makes every running thread of the
+//*  process execute a full barrier. Where membarrier is missing, readers
+//*  fall back to a fence of their own.
+//*  Compile with -std=c++17 or higher (aligned new, guaranteed elision).
+
+#ifndef rcu_hpp
+#define rcu_hpp
+
+#include <cstdint>
+#include <atomic>
+#include <memory>  // std::unique_ptr
+#include <mutex>
+#include <thread>  // std::this_thread::yield
+#ifdef __linux__
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace david {
+    namespace thread {
+        namespace rcu {
+            /** The grace-period counter and the readers' records. There is
+            *   one, domain::instance(), shared by every snapshot, since a
+            *   thread's record is kept in a single thread_local. */
+            class domain {
+                //* One per thread that has ever read, never freed.
+                struct alignas(64) record {
+                    // the grace period seen on entry, 0 outside a section
+                    std::atomic<std::uint64_t> period {0};
+                    std::atomic<bool> in_use {false};
+                    record* next = nullptr;
+                    unsigned nesting = 0; // only touched by its thread
+                };
+
+                std::atomic<std::uint64_t> mPeriod {1};
+                std::atomic<record*> mRecords {nullptr};
+                std::mutex mWriterMut;  // one grace period at a time
+                bool mMembarrier = false;
+                //* Convenience typedefs
+                using LGuard = std::lock_guard<std::mutex>;
+
+                domain() {
+#if defined(__linux__) && defined(__NR_membarrier)
+                    long cmds = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY,
+                        0);
+                    mMembarrier = cmds >= 0
+                        && (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED)
+                        && syscall(__NR_membarrier,
+                            MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+#endif
+                }
+
+                //* The readers' half of the barrier pairing.
+                void light_barrier() const {
+                    if (mMembarrier)
+                        std::atomic_signal_fence(std::memory_order_seq_cst);
+                    else
+                        std::atomic_thread_fence(std::memory_order_seq_cst);
+                }
+
+                //* The writer's half: a full barrier on every reader too.
+                void heavy_barrier() const {
+#if defined(__linux__) && defined(__NR_membarrier)
+                    if (mMembarrier && syscall(__NR_membarrier,
+                        MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) == 0)
+                        return;
+#endif
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                }
+
+                record* acquire() {
+                    for (record* r = mRecords.load(std::memory_order_acquire);
+                        r; r = r->next)
+                    {
+                        bool free = false;
+                        if (r->in_use.compare_exchange_strong(free, true))
+                            return r;
+                    }
+                    record* r = new record;
+                    r->in_use.store(true, std::memory_order_relaxed);
+                    r->next = mRecords.load(std::memory_order_relaxed);
+                    while (!mRecords.compare_exchange_weak(r->next, r,
+                        std::memory_order_release,
+                        std::memory_order_relaxed)) {}
+                    return r;
+                }
+
+                //* This thread's record, taken on first use.
+                record* local() {
+                    struct handle {
+                        record* rec = nullptr;
+                        ~handle() {
+                            if (rec) rec->in_use.store(false,
+                                std::memory_order_release);
+                        }
+                    };
+                    static thread_local handle h;
+                    if (!h.rec) h.rec = acquire();
+                    return h.rec;
+                }
+
+            public:
+                domain(const domain&) = delete;
+                domain& operator=(const domain&) = delete;
+
+                ~domain() {
+                    for (record* r = mRecords.load(); r; ) {
+                        record* next = r->next;
+                        delete r;
+                        r = next;
+                    }
+                }
+
+                //* The process-wide domain.
+                static domain& instance() {
+                    static domain d;
+                    return d;
+                }
+
+                //* Enters a read-side section; sections may nest.
+                void read_lock() {
+                    record* r = local();
+                    if (r->nesting++) return;
+                    r->period.store(mPeriod.load(std::memory_order_relaxed),
+                        std::memory_order_relaxed);
+                    // the record must be seen before anything shared is read
+                    light_barrier();
+                }
+
+                void read_unlock() {
+                    record* r = local();
+                    if (--r->nesting) return;
+                    light_barrier();
+                    r->period.store(0, std::memory_order_release);
+                }
+
+                /*  Waits out a grace period: returns once every read-side
+                *   section that was open on entry has closed. Sections
+                *   opened meanwhile are not waited for, so a steady stream
+                *   of readers can't hold a writer up. */
+                void synchronize() {
+                    LGuard lk(mWriterMut);
+                    std::uint64_t now = mPeriod.fetch_add(1,
+                        std::memory_order_seq_cst) + 1;
+                    heavy_barrier();
+                    for (record* r = mRecords.load(std::memory_order_acquire);
+                        r; r = r->next)
+                    {
+                        for (;;) {
+                            std::uint64_t p = r->period.load(
+                                std::memory_order_acquire);
+                            if (p == 0 || p >= now) break;
+                            std::this_thread::yield();
+                        }
+                    }
+                    // what the readers did before leaving happens before
+                    // anything the writer does next (such as freeing)
+                    heavy_barrier();
+                }
+            };
+
+            /** A read-side section holding @tparam T, which stays valid
+            *   (and unchanged) until the reader is destroyed. */
+            template <typename T>
+            class reader {
+                const T* mData;
+            public:
+                explicit reader(const std::atomic<const T*>& current)
+                {
+                    domain::instance().read_lock();
+                    mData = current.load(std::memory_order_acquire);
+                }
+                reader(const reader&) = delete;
+                reader& operator=(const reader&) = delete;
+                ~reader() { domain::instance().read_unlock(); }
+
+                const T* get() const noexcept { return mData; }
+                const T& operator*() const noexcept { return *mData; }
+                const T* operator->() const noexcept { return mData; }
+                explicit operator bool() const noexcept { return mData; }
+            };
+
+            /** Holds the current version of a @tparam T. Readers never
+            *   block, and never slow each other down; writers are
+            *   serialized, and each waits for a grace period before it
+            *   frees the version it replaced. */
+            template <typename T>
+            class snapshot {
+                std::atomic<const T*> mCurrent;
+                std::mutex mWriteMut;   // one writer at a time
+                //* Convenience typedefs
+                using LGuard = std::lock_guard<std::mutex>;
+
+                void replace(const T* next) {
+                    const T* old = mCurrent.exchange(next,
+                        std::memory_order_acq_rel);
+                    if (!old) return;
+                    domain::instance().synchronize();
+                    delete old;
+                }
+
+            public:
+                //* Default constructor. Holds nothing until the first publish.
+                snapshot() : mCurrent(nullptr) {}
+                explicit snapshot(std::unique_ptr<T> first)
+                : mCurrent(first.release()) {}
+
+                snapshot(const snapshot&) = delete;
+                snapshot& operator=(const snapshot&) = delete;
+
+                //* No reader may outlive the snapshot.
+                ~snapshot() { delete mCurrent.load(); }
+
+                /** @return: a reader of the current version (which may be
+                *   null, if nothing has been published) */
+                reader<T> read() const { return reader<T>(mCurrent); }
+
+                /** Makes @param next the current version, then waits for
+                *   the readers of the previous one and frees it. */
+                void publish(std::unique_ptr<T> next) {
+                    LGuard lk(mWriteMut);
+                    replace(next.release());
+                }
+
+                /** Read-copy-update: publishes a copy of the current version
+                *   after @param fn(T&) has changed it. Writers are serialized,
+                *   so no update is lost. */
+                template <class Fn>
+                void update(Fn fn) {
+                    LGuard lk(mWriteMut);
+                    const T* cur = mCurrent.load(std::memory_order_acquire);
+                    std::unique_ptr<T> next (cur ? new T(*cur) : new T());
+                    fn(*next);
+                    replace(next.release());
+                }
+            };
+        }
+    }
+}
+
+#endif /* rcu_hpp */
@@ -0,0 +1,169 @@
+//
+//  sequenced_queue.hpp
+//  thread_support
+//
+//*  An order-preserving parallel stage for thread_queue pipelines.
+//*  Items are stamped with a sequence number as they are pushed; any number
+//*  of workers pop and process them in parallel, and complete() hands each
+//*  result to a reorder buffer that releases results strictly in sequence.
+//*  At most `window` items are in flight (pushed but not yet released), so
+//*  the reorder buffer never holds more than that; push() waits for room.
+
+#ifndef sequenced_queue_hpp
+#define sequenced_queue_hpp
+
+#include "structs_fwd.hpp"
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <utility> // std::pair
+
+namespace david {
+    namespace thread {
+        template <typename T, typename R = T>
+        class sequenced_queue {
+        public:
+            using value_type  = T;
+            using result_type = R;
+            using size_type   = std::size_t;
+            using seq_type    = std::size_t;
+
+        private:
+            std::deque<std::pair<seq_type, value_type>> mWork;
+            std::vector<result_type> mResults; // ring, indexed seq % window
+            std::vector<char>        mReady;   // whether mResults[i] is set
+            seq_type mNextIn  = 0;             // next sequence to stamp
+            seq_type mNextOut = 0;             // next sequence to release
+            bool     mClosed  = false;
+            mutable std::mutex mMut;
+            std::condition_variable mHasRoom, mHasWork, mHasResult;
+            //* Convenience typedefs
+            using LGuard = std::lock_guard<std::mutex>;
+            using ULock = std::unique_lock<std::mutex>;
+
+            size_type window() const noexcept { return mResults.size(); }
+            bool result_ready() const {
+                return mReady[mNextOut % window()] != 0;
+            }
+
+            void take_result(result_type& value) {
+                size_type slot = mNextOut % window();
+                value = std::move_if_noexcept(mResults[slot]);
+                mReady[slot] = 0;
+                ++mNextOut;
+                mHasRoom.notify_one();
+            }
+
+        public:
+            /** Constructs an empty sequenced_queue.
+            *   @param <window>: most items in flight at once (at least 1) */
+            explicit sequenced_queue(size_type window = 64)
+            : mResults(window ? window : 1), mReady(window ? window : 1) {}
+
+            sequenced_queue(const sequenced_queue&) = delete;
+            sequenced_queue& operator=(const sequenced_queue&) = delete;
+            ~sequenced_queue() = default;
+
+            /** Stamps @param val with the next sequence number and queues it
+            *   for the workers, waiting while the window is full.
+            *   @return: the sequence number it was given.
+            *   @throw std::logic_error if the queue has been closed. */
+            seq_type push(value_type val) {
+                ULock lk(mMut);
+                mHasRoom.wait(lk, [this]{
+                    return mNextIn - mNextOut < window() || mClosed;
+                });
+                if (mClosed)
+                    throw std::logic_error("push to a closed sequenced_queue");
+                seq_type seq = mNextIn++;
+                mWork.emplace_back(seq, std::move_if_noexcept(val));
+                mHasWork.notify_one();
+                return seq;
+            }
+
+            /** Marks the end of input. Workers drain what is left, then
+            *   their pops return false; so does pop_result() once every
+            *   result has been released. */
+            void close() {
+                LGuard lk(mMut);
+                mClosed = true;
+                mHasWork.notify_all();
+                mHasResult.notify_all();
+                mHasRoom.notify_all();
+            }
+
+            /** Worker side: waits for an item, or for the queue to close.
+            *   @param seq, @param value are overwritten with the next item.
+            *   @return: false once the queue is closed and drained. */
+            bool wait_and_pop(seq_type& seq, value_type& value) {
+                ULock lk(mMut);
+                mHasWork.wait(lk, [this]{ return !mWork.empty() || mClosed; });
+                if (mWork.empty()) return false;
+                seq   = mWork.front().first;
+                value = std::move_if_noexcept(mWork.front().second);
+                mWork.pop_front();
+                return true;
+            }
+
+            /** Worker side: non-blocking wait_and_pop().
+            *   @return: whether an item was popped. */
+            bool try_pop(seq_type& seq, value_type& value) {
+                LGuard lk(mMut);
+                if (mWork.empty()) return false;
+                seq   = mWork.front().first;
+                value = std::move_if_noexcept(mWork.front().second);
+                mWork.pop_front();
+                return true;
+            }
+
+            /** Worker side: hands in the result for sequence @param seq.
+            *   It is released once every earlier result has been. */
+            void complete(seq_type seq, result_type result) {
+                LGuard lk(mMut);
+                size_type slot = seq % window();
+                mResults[slot] = std::move_if_noexcept(result);
+                mReady[slot] = 1;
+                if (seq == mNextOut) mHasResult.notify_one();
+            }
+
+            /** Downstream side: waits for the next result in sequence.
+            *   @param value is overwritten with it.
+            *   @return: false once the queue is closed and every pushed
+            *   item's result has been released. */
+            bool pop_result(result_type& value) {
+                ULock lk(mMut);
+                mHasResult.wait(lk, [this]{
+                    return result_ready() || (mClosed && mNextOut == mNextIn);
+                });
+                if (!result_ready()) return false;
+                take_result(value);
+                return true;
+            }
+
+            /** Downstream side: non-blocking pop_result().
+            *   @return: whether the next result in sequence was ready. */
+            bool try_pop_result(result_type& value) {
+                LGuard lk(mMut);
+                if (!result_ready()) return false;
+                take_result(value);
+                return true;
+            }
+
+            /** @return: the number of items pushed but not yet released */
+            size_type in_flight() const {
+                LGuard lk(mMut);
+                return mNextIn - mNextOut;
+            }
+
+            /** @return: whether nothing is in flight */
+            bool empty() const {
+                LGuard lk(mMut);
+                return mNextIn == mNextOut;
+            }
+        };
+    }
+}
+
+#endif /* sequenced_queue_hpp */
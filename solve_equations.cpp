@@ -7,9 +7,26 @@
 //  File to solve math equations, adding, subtracting, multiplying and
 //  dividing doubles.
 //  To test my thread_queue
+//  Usage: solve_equations [-s | -b] [-m] [-p] [input] [output]. By default, the
+//  whole input is read, solved and then printed once per distinct ID, in ID
+//  order.
+//  With -s (--stream), it is streamed through a pipeline of thread_queues
+//  in bounded memory, printing every equation in input order as it goes.
+//  With -m (--memo), results are memoized on the bits of (a, op, b) in a
+//  bounded cache, and its hit and miss counts are reported at the end.
+//  With -p (--perf), the solving is counted with perf_counters.hpp, and its
+//  cycles, instructions, misses and context switches per equation are
+//  reported at the end, per solver thread.
+//  Besides "id: a op b", a line may hold any arithmetic expression with
+//  precedence and parentheses, e.g. "7: (1.5 + 2) * 4 - 7 / 2"; those are
+//  compiled by expression.hpp and solved in batches of the same shape.
+//  The input may also be a binary equation file (see equation_file.hpp),
+//  which is solved straight from its mapping; with -b (--binary), the
+//  solutions are written in that format too.
+//  A loaded input is published through an RCU snapshot (rcu.hpp), so the
+//  solvers read it without locks and a new one can be loaded meanwhile.
 
-//  TODO: make this use my thread_queue!
-//  compile this file with -std=c++14 or higher.
+//  compile this file with -std=c++17 or higher.
 
 #include <iostream>
 #include <fstream>
@@ -19,7 +36,24 @@
 #include <future>
 #include <chrono>
 #include <random>
-#include <map>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include "thread_queue.hpp"
+#include "thread_map.hpp"
+#include "rcu.hpp"
+#include "parallel_algorithms.hpp"
+#include "sequenced_queue.hpp"
+#include "mapped_file.hpp"
+#include "equation_kernel.hpp"
+#include "memo_cache.hpp"
+#include "expression.hpp"
+#include "equation_file.hpp"
+#include "output_writer.hpp"
+#include "perf_counters.hpp"
 
 struct operation {
     double  a;
@@ -67,103 +101,677 @@ struct operation {
     ~operation() = default;
 };
 
-inline std::ostream& operator<< (std::ostream& o, const operation& Op) {
+//* Out is an std::ostream, or a formatter from output_writer.hpp
+template <class Out>
+inline Out& operator<< (Out& o, const operation& Op) {
     o << Op.a << ' ' << Op.op << ' ' << Op.b;
     return o;
 }
 
-std::map<unsigned, operation>& Equations() {
-    static std::map<unsigned, operation> eqns;
-    return eqns;
+/*  The columns being solved, wherever they live: an equation_table's own
+*   vectors, or a mapped binary equation file. A mapped file's ops are all
+*   checked to be binary, so only a table's columns hold op_none. */
+static_assert(david::io::equation_file_op_limit == david::math::op_none,
+    "equation files hold exactly the binary op codes");
+struct equation_view {
+    const std::uint32_t*     ids = nullptr;
+    david::math::column_view cols {nullptr, nullptr, nullptr};
+    std::size_t              size = 0;
+};
+
+/*  Every equation in input order, as aligned columns for the kernels in
+*   equation_kernel.hpp, plus a result column that each solver thread writes
+*   directly for its own block of positions. Longer expressions hold op_none
+*   in the columns and are kept, compiled, in compounds (by position). */
+struct equation_table {
+    struct compound {
+        std::uint32_t pos;
+        std::string   text;
+        david::math::compiled expr;
+    };
+
+    std::vector<std::uint32_t>          ids;
+    david::math::equation_columns       cols;
+    david::math::aligned_vector<double> results;
+    std::vector<compound>               compounds;
+    unsigned max_id = 0;
+
+    std::size_t size() const noexcept { return ids.size(); }
+    void push_back(unsigned id, const operation& eq) {
+        ids.push_back(id);
+        cols.push_back(eq.a, eq.op, eq.b);
+        if (id > max_id) max_id = id;
+    }
+    void push_back(unsigned id, std::string text, david::math::compiled expr) {
+        compounds.push_back(compound {std::uint32_t(size()), std::move(text),
+            std::move(expr)});
+        push_back(id, operation(0.0, '\0', 0.0));
+    }
+    equation_view view() const noexcept {
+        return equation_view {ids.data(), cols.view(), size()};
+    }
+    operation operator[](std::size_t i) const {
+        return operation(cols.a[i], david::math::to_op_char(cols.op[i]),
+            cols.b[i]);
+    }
+    //* Prints equation @param i as it was written (without its ID).
+    template <class Out>
+    void print(Out& o, std::size_t i) const {
+        if (cols.op[i] != david::math::op_none) {
+            o << (*this)[i];
+            return;
+        }
+        auto it = std::lower_bound(compounds.begin(), compounds.end(), i,
+            [](const compound& c, std::size_t x) { return c.pos < x; });
+        if (it != compounds.end() && it->pos == i) o << it->text;
+        else o << (*this)[i];
+    }
+};
+
+/*  One loaded input: parsed into table, or mapped in place from a binary
+*   file, with view over whichever it is. It is never changed once it is
+*   published in Loaded: results go to a column of the solving run's own,
+*   so a reload can publish the next input while solvers read this one. */
+struct equation_set {
+    equation_table           table;   // parsed text; max_id for either
+    david::io::equation_file mapped;  // a binary input's columns
+    equation_view            view;    // what the solver threads read
+};
+
+david::thread::rcu::snapshot<equation_set> Loaded;
+
+using equation = std::pair<unsigned, operation>;
+
+/*  Parses one "id: a op b" line at @p straight from the input bytes, and
+*   advances @p to the start of the next line either way.
+*   @return: whether @eq was filled in. @rest is left just past b, or past
+*   the ID's colon if only the ID was read, or at the line's start if not.
+*   An ID not followed by its colon is a fragment of a mangled line, such
+*   as "83.7 * -8918.49", and is not read. */
+bool parse_equation(const char*& p, const char* last, equation& eq,
+    const char*& rest)
+{
+    using namespace david::io;
+    const char* line = p;
+    p = next_line(p, last);
+    rest = line;
+    unsigned x; double a, b;
+    if (!parse_int(line, p, x)) return false;
+    line = skip_blanks(line, p);
+    if (line == p || *line != ':') return false; // the colon I added
+    eq.first = x;
+    rest = ++line;
+    if (!parse_double(line, p, a)) return false;
+    line = skip_blanks(line, p);
+    if (line == p) return false;
+    char op = *line++;
+    if (david::math::to_op_code(op) == david::math::op_none)
+        return false; // a line mangled by interleaved writes
+    if (!parse_double(line, p, b)) return false;
+    eq.second = operation(a, op, b);
+    rest = line;
+    return true;
 }
 
-void add_equation(std::stringstream& ss) {
-    unsigned x; char c;
-    ss >> x >> c; // c absorbs the colon I added
-    auto pear = std::make_pair(x, operation(ss));
-    Equations().insert(pear);
+/*  Parses the line at @p into @table: "a op b" through the fast path above,
+*   and anything longer as a full expression. A line that is neither (or is
+*   a lone number, or names a variable) is skipped. */
+void parse_line(const char*& p, const char* last, equation_table& table) {
+    using namespace david::io;
+    equation eq(0, operation(0.0, '+', 0.0));
+    const char* rest;
+    const char* line = p;
+    bool simple = parse_equation(p, last, eq, rest);
+    const char* after = skip_blanks(rest, p);
+    if (simple && (after == p || *after == '\n'
+        || david::math::to_op_code(*after) == david::math::op_none)) {
+        table.push_back(eq.first, eq.second); // the common case
+        return;
+    }
+    if (rest == line) return; // no ID
+    const char* text = line;
+    unsigned id;
+    parse_int(text, p, id);
+    text = skip_blanks(skip_blanks(text, p) + 1, p); // past the colon
+    const char* end = p;
+    while (end != text && (end[-1] == '\n' || end[-1] == '\r'
+        || end[-1] == ' ' || end[-1] == '\t')) --end;
+    try {
+        auto tree = david::math::parse(std::string_view(text, end - text));
+        // a bare number is a mangled line, not an equation
+        if (tree.variables.empty()
+            && tree.nodes[tree.root].kind != david::math::node_kind::literal) {
+            table.push_back(eq.first, std::string(text, end),
+                david::math::compile(tree, true));
+            return;
+        }
+    } catch (david::math::expression_error&) {}
+    if (simple) table.push_back(eq.first, eq.second); // as it always was
 }
 
-void init_map(const std::string& inFile) {
-    std::ifstream input (inFile);
-    if (!input.is_open()) throw std::domain_error("Input not open.");
-    std::string s;
-    while (std::getline(input, s)) {
-        std::stringstream ss(s);
-        add_equation(ss);
+/*  Loads the input. A binary equation file is used in place: the view
+*   points into the mapping. Text is parsed in newline-aligned chunks, one
+*   thread per chunk, and the chunks are then laid out in file order. */
+std::unique_ptr<equation_set> load_equations(const std::string& inFile) {
+    using namespace david::io;
+    mapped_file input;
+    try { input = mapped_file(inFile); }
+    catch (std::system_error&) { throw std::domain_error("Input not open."); }
+    std::unique_ptr<equation_set> set (new equation_set);
+    if (is_equation_file(input)) {
+        auto&& mapped = set->mapped;
+        try { mapped = equation_file(std::move(input)); }
+        catch (format_error& fe) { throw std::domain_error(fe.what()); }
+        auto&& view = set->view;
+        view = equation_view {mapped.ids(),
+            david::math::column_view {mapped.a(), mapped.op(), mapped.b()},
+            mapped.size()};
+        if (view.size)
+            set->table.max_id = *std::max_element(view.ids,
+                view.ids + view.size);
+        return set;
+    }
+    auto chunks = split_lines(input.begin(), input.end(), default_chunks());
+    std::vector<equation_table> parsed (chunks.size());
+    for_each_chunk(chunks, [&parsed](std::size_t i, text_chunk c) {
+        parsed[i].ids.reserve(c.size() / 16);
+        parsed[i].cols.reserve(c.size() / 16);
+        for (const char* p = c.first; p != c.last; )
+            parse_line(p, c.last, parsed[i]);
+    });
+
+    auto&& table = set->table;
+    std::vector<std::size_t> offsets (parsed.size() + 1);
+    for (std::size_t i = 0; i < parsed.size(); ++i) {
+        offsets[i + 1] = offsets[i] + parsed[i].size();
+        if (parsed[i].max_id > table.max_id) table.max_id = parsed[i].max_id;
     }
+    auto n = offsets.back();
+    table.ids.resize(n);
+    table.cols.a.resize(n); table.cols.op.resize(n); table.cols.b.resize(n);
+    for_each_chunk(chunks, [&](std::size_t i, text_chunk) {
+        auto&& from = parsed[i];
+        auto at = offsets[i];
+        std::copy(from.ids.begin(), from.ids.end(), table.ids.begin() + at);
+        std::copy(from.cols.a.begin(),  from.cols.a.end(),
+            table.cols.a.begin() + at);
+        std::copy(from.cols.op.begin(), from.cols.op.end(),
+            table.cols.op.begin() + at);
+        std::copy(from.cols.b.begin(),  from.cols.b.end(),
+            table.cols.b.begin() + at);
+        equation_table().ids.swap(from.ids); // done with it
+    });
+    for (std::size_t i = 0; i < parsed.size(); ++i)
+        for (auto&& c : parsed[i].compounds) {
+            c.pos += std::uint32_t(offsets[i]);
+            table.compounds.push_back(std::move(c));
+        }
+    set->view = table.view();
+    return set;
 }
 
-std::pair<unsigned, double> pairwise_eval(const typename
-    std::remove_reference_t<decltype(Equations())>::value_type& pear)
+/*  Maps each equation ID to the input position of its first occurrence, so
+*   a repeated ID keeps its first equation. Solver threads record positions
+*   concurrently without a shared lock: dense IDs go straight into a
+*   pre-sized array of atomics (an atomic min per slot), while sparse IDs
+*   fall back to a lock-striped thread_map. */
+class id_index {
+    static constexpr std::uint32_t none = std::uint32_t(-1);
+    using sparse_map = david::thread::thread_map<unsigned, std::uint32_t>;
+
+    std::unique_ptr<std::atomic<std::uint32_t>[]> mDense;
+    std::size_t mDenseSize = 0;
+    std::unique_ptr<sparse_map> mSparse;
+
+public:
+    /** Dense if the ID range is at most about twice the equation count. */
+    id_index(unsigned max_id, std::size_t count) {
+        if (std::size_t(max_id) <= 2 * count + 1024) {
+            mDenseSize = std::size_t(max_id) + 1;
+            mDense.reset(new std::atomic<std::uint32_t>[mDenseSize]);
+            for (std::size_t i = 0; i < mDenseSize; ++i)
+                mDense[i].store(none, std::memory_order_relaxed);
+        } else {
+            mSparse.reset(new sparse_map(4 * david::io::default_chunks(),
+                count));
+        }
+    }
+
+    bool dense() const noexcept { return mDenseSize != 0; }
+
+    //* Records that equation @param pos has ID @param id.
+    void insert(unsigned id, std::uint32_t pos) {
+        if (dense()) {
+            auto&& slot = mDense[id];
+            std::uint32_t seen = slot.load(std::memory_order_relaxed);
+            while (pos < seen && !slot.compare_exchange_weak(seen, pos,
+                std::memory_order_relaxed)) {}
+        } else {
+            mSparse->update(id, [pos](std::uint32_t& seen) {
+                if (pos < seen) seen = pos;
+            }, pos);
+        }
+    }
+
+    /** A run of IDs: IDs [first, last) if dense, or else entries
+    *   [first, last) of the sorted list that split() builds. */
+    struct id_range { std::size_t first, last; };
+
+    /** Splits every ID into @param parts ranges, in ascending order, for
+    *   for_each() to visit in parallel. Only call once every insert has
+    *   finished. */
+    std::vector<id_range> split(std::size_t parts) {
+        if (parts == 0) parts = 1;
+        std::size_t n = mDenseSize;
+        if (!dense()) {
+            mSorted = sorted();
+            n = mSorted.size();
+        }
+        std::vector<id_range> ranges;
+        for (std::size_t p = 0; p < parts; ++p)
+            ranges.push_back(id_range {n * p / parts, n * (p + 1) / parts});
+        return ranges;
+    }
+
+    //* Calls fn(id, pos) for every ID in @param r, in ascending order.
+    template <class Fn>
+    void for_each(Fn&& fn, id_range r) const {
+        if (dense()) {
+            for (std::size_t id = r.first; id < r.last; ++id) {
+                auto pos = mDense[id].load(std::memory_order_relaxed);
+                if (pos != none) fn(unsigned(id), pos);
+            }
+            return;
+        }
+        for (std::size_t i = r.first; i < r.last; ++i)
+            fn(mSorted[i].first, mSorted[i].second);
+    }
+
+    /** Calls fn(id, pos) for every ID in ascending order. Only call once
+    *   every insert has finished. */
+    template <class Fn>
+    void for_each(Fn&& fn) const {
+        if (dense()) {
+            for_each(fn, id_range {0, mDenseSize});
+            return;
+        }
+        for (auto&& pr : sorted()) fn(pr.first, pr.second);
+    }
+
+private:
+    std::vector<std::pair<unsigned, std::uint32_t>> mSorted; // by split()
+
+    std::vector<std::pair<unsigned, std::uint32_t>> sorted() const {
+        std::vector<std::pair<unsigned, std::uint32_t>> all;
+        all.reserve(mSparse->size());
+        mSparse->for_each([&all](unsigned id, std::uint32_t pos) {
+            all.emplace_back(id, pos);
+        });
+        david::thread::parallel_sort(all.begin(), all.end());
+        return all;
+    }
+};
+
+/*  Prints every distinct ID in ascending order, with its first equation
+*   from @eqns and its result from @results.
+*   The IDs are split into @parts runs, each formatted on the shared pool
+*   into its own lane of @out, which writes the lanes in order. */
+void print_map(const equation_set& eqns, const double* results,
+    id_index& index, david::io::output_writer& out, std::size_t parts)
 {
-    return std::pair<unsigned, double> (pear.first, pear.second());
+    auto&& cols = eqns.view.cols;
+    auto ranges = index.split(parts);
+    auto print_part = [&](std::size_t part) {
+        auto o = out.open_lane(part);
+        index.for_each([&](unsigned id, std::uint32_t pos) {
+            o << id << ": ";
+            if (cols.op[pos] != david::math::op_none)
+                o << operation(cols.a[pos],
+                    david::math::to_op_char(cols.op[pos]), cols.b[pos]);
+            else
+                eqns.table.print(o, pos);
+            o << " = " << results[pos] << '\n';
+        }, ranges[part]);
+    };
+    david::thread::parallel_for(std::size_t(0), ranges.size(), print_part,
+        std::size_t(1));
 }
 
-std::map<unsigned, double>& Solutions() {
-    static std::map<unsigned, double> solns;
-    return solns;
+/*  Writes every distinct ID in ascending order, with its first equation and
+*   result, as a binary equation file. Compound expressions have no binary
+*   form, so they are left out. @return: how many were left out. */
+std::size_t write_map(const equation_set& eqns, const double* results,
+    const id_index& index, std::ostream& o)
+{
+    auto&& cols = eqns.view.cols;
+    std::vector<std::uint32_t> ids;
+    david::math::equation_columns out;
+    david::math::aligned_vector<double> solved;
+    std::size_t skipped = 0;
+    index.for_each([&](unsigned id, std::uint32_t pos) {
+        if (cols.op[pos] == david::math::op_none) { ++skipped; return; }
+        ids.push_back(id);
+        out.a.push_back(cols.a[pos]);
+        out.op.push_back(cols.op[pos]);
+        out.b.push_back(cols.b[pos]);
+        solved.push_back(results[pos]);
+    });
+    david::io::write_equation_file(o, ids.size(), ids.data(), out.a.data(),
+        out.op.data(), out.b.data(), solved.data());
+    return skipped;
 }
 
-std::mutex map_mutex;
-void solve(unsigned i) {
-    std::lock_guard<std::mutex> lk(map_mutex);
-    Solutions().insert(pairwise_eval(*Equations().find(i)));
+unsigned hwc = std::thread::hardware_concurrency();
+unsigned num_threads = (hwc ? hwc - 1 : 3);
+
+//* @return: how many threads the shared pool's algorithms run on.
+unsigned pool_threads() {
+    return david::thread::task_pool::shared().concurrency();
 }
 
-void print_map(std::ostream& o = std::cout) {
-    auto&& Solved = Solutions();
-    for (const auto& eq : Equations()) {
-        o << eq.first << ": " << eq.second << " = " << Solved[eq.first] << '\n';
+/*  Memoization key: the exact bit patterns of a and b, and the op code, so
+*   -0.0 and 0.0 (or two NaNs) are distinct keys, as they may solve
+*   differently. */
+struct equation_key {
+    std::uint64_t a, b;
+    std::uint8_t  op;
+    friend bool operator==(const equation_key& x, const equation_key& y) {
+        return x.a == y.a && x.b == y.b && x.op == y.op;
+    }
+};
+
+struct equation_key_hash {
+    std::size_t operator()(const equation_key& k) const noexcept {
+        std::uint64_t h = k.a * 0x9e3779b97f4a7c15ull;
+        h ^= (k.b + k.op) * 0xc2b2ae3d27d4eb4full;
+        return std::size_t(h ^ (h >> 31));
+    }
+};
+
+using result_cache = david::thread::memo_cache<equation_key, double,
+    equation_key_hash>;
+
+/*  Solves equations [i, k) of @cols into @out. Without a @cache that is one
+*   vectorized kernel call; with one, each equation is looked up first and
+*   only evaluated (and cached) on a miss. */
+void solve_block(david::math::column_view cols, double* out,
+    std::size_t i, std::size_t k, result_cache* cache)
+{
+    if (!cache) {
+        david::math::evaluate(cols, out, i, k);
+        return;
+    }
+    for (std::size_t x = i; x < k; ++x) {
+        if (cols.op[x] == david::math::op_none) continue; // a compound
+        equation_key key {0, 0, cols.op[x]};
+        std::memcpy(&key.a, &cols.a[x], sizeof key.a);
+        std::memcpy(&key.b, &cols.b[x], sizeof key.b);
+        out[x] = cache->get_or_compute(key, [&cols, x]() {
+            return david::math::evaluate_one(cols.a[x], cols.op[x], cols.b[x]);
+        });
     }
 }
 
-unsigned hwc = std::thread::hardware_concurrency();
-unsigned num_threads = (hwc ? hwc - 1 : 3);
+result_cache* Memo = nullptr; // set by -m
+david::thread::perf::region Perf ("solve", false); // enabled by -p
+
+/*  Solves every compound expression of @eqns into @results, after the
+*   kernels have run. Expressions of the same shape (equal up to their
+*   numbers) share one program, which runs them all in its SIMD lanes. */
+void solve_compounds(const equation_table& eqns, double* results) {
+    using group = std::vector<const equation_table::compound*>;
+    std::unordered_map<std::string, group> shapes;
+    for (auto&& c : eqns.compounds) shapes[c.expr.prog.shape()].push_back(&c);
+    std::vector<double> inputs, out;
+    std::vector<const double*> slots;
+    for (auto&& sh : shapes) {
+        const group& g = sh.second;
+        const auto& prog = g.front()->expr.prog;
+        std::size_t lanes = g.size(), k = prog.inputs();
+        inputs.resize(k * lanes);
+        for (std::size_t l = 0; l < lanes; ++l)
+            for (std::size_t s = 0; s < k; ++s)
+                inputs[s * lanes + l] = g[l]->expr.literals[s];
+        slots.resize(k);
+        for (std::size_t s = 0; s < k; ++s) slots[s] = &inputs[s * lanes];
+        out.resize(lanes);
+        prog.run(lanes, slots.data(), out.data());
+        for (std::size_t l = 0; l < lanes; ++l)
+            results[g[l]->pos] = out[l];
+    }
+}
+
+/*  Solves positions [i, k) of @eqns with one kernel call straight into
+*   @results, and records their IDs in @index. No locks are taken on the
+*   dense path, so blocks proceed fully in parallel. */
+void solve_range(const equation_set& eqns, double* results, unsigned i,
+    unsigned k, id_index& index)
+{
+    david::thread::perf::scope counted (Perf, k - i);
+    solve_block(eqns.view.cols, results, i, k, Memo);
+    for (unsigned a = i; a < k; ++a) index.insert(eqns.view.ids[a], a);
+}
+
+/*  Equations per block at the least: enough for the kernels to run at full
+*   width, few enough that the pool can even out uneven blocks. */
+constexpr unsigned solve_grain = 2048;
+
+/*  Streaming mode: reader -> parser/solver workers -> writer. Chunks of whole
+*   lines circulate through a fixed pool in a thread_queue, so at most
+*   chunks_in_flight of them (and their results) exist at once; the reader
+*   blocks on the pool when the workers or writer fall behind. A
+*   sequenced_queue between the stages lets the workers solve chunks in any
+*   order while the writer still receives them in input order. */
+namespace streaming {
+    using david::thread::thread_queue;
+    using david::thread::sequenced_queue;
+
+    constexpr std::size_t chunk_bytes = 1 << 18;
 
-void solve_range(unsigned i, unsigned j, unsigned lim_eqns) {
-    unsigned k = j < lim_eqns ? j : lim_eqns;
-    for (unsigned a = i; a < k; ++a) solve(a);
+    struct chunk {
+        std::string    text;    // whole lines of input
+        equation_table eqns;    // parsed from text, with results
+        std::string    out;     // formatted results
+    };
+    using chunk_ptr = std::unique_ptr<chunk>;
+
+    //* Parses, solves and formats one chunk; the work of a pipeline worker.
+    void solve_chunk(chunk& c) {
+        david::thread::perf::scope counted (Perf);
+        auto&& eqns = c.eqns;
+        eqns.ids.clear(); eqns.compounds.clear();
+        eqns.cols.a.clear(); eqns.cols.op.clear(); eqns.cols.b.clear();
+        const char* last = c.text.data() + c.text.size();
+        for (const char* p = c.text.data(); p != last; )
+            parse_line(p, last, eqns);
+        eqns.results.resize(eqns.size());
+        solve_block(eqns.cols.view(), eqns.results.data(), 0, eqns.size(),
+            Memo);
+        solve_compounds(eqns, eqns.results.data());
+        counted.ops(eqns.size());
+        c.out.clear();
+        david::io::string_formatter fmt (c.out);
+        for (std::size_t i = 0; i < eqns.size(); ++i) {
+            fmt << eqns.ids[i] << ": ";
+            eqns.print(fmt, i);
+            fmt << " = " << eqns.results[i] << '\n';
+        }
+    }
+
+    /** Streams @param in to @param out with @param workers solver threads.
+    *   @return: the number of chunks read. */
+    std::size_t solve_stream(std::istream& in, std::ostream& out,
+        unsigned workers)
+    {
+        if (workers == 0) workers = 1;
+        const std::size_t chunks_in_flight = 2 * workers + 2;
+        thread_queue<chunk_ptr> free_chunks;
+        sequenced_queue<chunk_ptr> stage (chunks_in_flight);
+        for (std::size_t i = 0; i < chunks_in_flight; ++i)
+            free_chunks.push(chunk_ptr(new chunk));
+
+        std::vector<std::thread> solvers;
+        for (unsigned w = 0; w < workers; ++w) {
+            solvers.emplace_back([&]() {
+                std::size_t seq;
+                chunk_ptr c;
+                while (stage.wait_and_pop(seq, c)) {
+                    solve_chunk(*c);
+                    stage.complete(seq, std::move(c));
+                }
+            });
+        }
+
+        std::thread writer([&]() {
+            chunk_ptr c;
+            while (stage.pop_result(c)) {
+                out.write(c->out.data(), c->out.size());
+                out.flush();
+                free_chunks.push(std::move(c));
+            }
+        });
+
+        // the reader runs on this thread
+        std::string carry;
+        std::size_t seq = 0;
+        chunk_ptr c;
+        while (in || !carry.empty()) {
+            free_chunks.wait_and_pop(c);
+            c->text.swap(carry);
+            carry.clear();
+            // read on until the chunk ends a line, or the input ends, so a
+            // line longer than chunk_bytes is never split between chunks
+            // (carry holds no newline, so only new text is searched)
+            std::size_t have = c->text.size(), nl = std::string::npos;
+            do {
+                c->text.resize(have + chunk_bytes);
+                in.read(&c->text[have], chunk_bytes);
+                c->text.resize(have + in.gcount());
+                auto at = std::string_view(c->text).substr(have).rfind('\n');
+                if (at != std::string::npos) nl = have + at;
+                have = c->text.size();
+            } while (in && nl == std::string::npos);
+            // hold back a trailing partial line for the next chunk
+            if (in) {
+                carry.assign(c->text, nl + 1, std::string::npos);
+                c->text.resize(nl + 1);
+            }
+            if (c->text.empty()) {
+                free_chunks.push(std::move(c));
+                break;
+            }
+            ++seq;
+            stage.push(std::move(c));
+        }
+        stage.close();
+        for (auto&& th : solvers) th.join();
+        writer.join();
+        return seq;
+    }
+}
+
+//* @return: whether the file at @param path is a binary equation file.
+bool binary_input(const std::string& path) {
+    std::ifstream in (path, std::ios::binary);
+    char magic[sizeof david::io::equation_file_magic] = {};
+    in.read(magic, sizeof magic);
+    return in && std::memcmp(magic, david::io::equation_file_magic,
+        sizeof magic) == 0;
+}
+
+void report_memo() {
+    if (!Memo) return;
+    auto st = Memo->stats();
+    std::cout << "memo: " << st.hits << " hits, " << st.misses << " misses, "
+        << st.evictions << " evictions, " << st.size << '/' << st.capacity
+        << " entries" << std::endl;
+}
+
+void report_perf() {
+    if (Perf.enabled()) Perf.report(std::cout);
 }
 
 int main(int argc, char* argv[])
 {
+    bool stream = false, binary = false;
+    std::unique_ptr<result_cache> memo;
+    for (; argc > 1 && argv[1][0] == '-'; --argc, ++argv) {
+        std::string flag (argv[1]);
+        if (flag == "-s" || flag == "--stream") stream = true;
+        else if (flag == "-m" || flag == "--memo") memo.reset(new result_cache);
+        else if (flag == "-b" || flag == "--binary") binary = true;
+        else if (flag == "-p" || flag == "--perf") Perf.enable();
+        else {
+            std::cerr << "Usage: solve_equations [-s | -b] [-m] [-p] [input] "
+                "[output]\n";
+            return 1;
+        }
+    }
+    if (stream && binary) {
+        std::cerr << "Streaming writes text; -s and -b cannot be combined.\n";
+        return 1;
+    }
+    Memo = memo.get();
     std::string inFile = (argc > 1 ? argv[1] : "resources/equations.txt");
     std::string outFile = (argc > 2 ? argv[2] : "output/solutions.txt");
-    try { init_map(inFile); }
+    // a binary input is already mapped in place, so it is never streamed
+    if (stream && !binary_input(inFile)) {
+        std::ifstream input (inFile, std::ios::binary);
+        std::ofstream output (outFile, std::ios::binary);
+        if (!input.is_open() || !output.is_open()) {
+            std::cerr << "Could not open input or output file.\n";
+            return -2;
+        }
+        streaming::solve_stream(input, output, num_threads ? num_threads : 1);
+        report_memo();
+        report_perf();
+        return 0;
+    }
+    try { Loaded.publish(load_equations(inFile)); }
     catch (std::domain_error& de) {
         std::cerr << de.what() << std::endl;
         return -1;
     }
     /*  make sure we have an output file before we do the work solving the
     *   equations */
-    std::ofstream output (outFile);
-    if (!output.is_open()) {
+    std::ofstream output;
+    std::unique_ptr<david::io::output_writer> text;
+    if (binary) output.open(outFile, std::ios::binary);
+    else try { text.reset(new david::io::output_writer(outFile)); }
+    catch (std::system_error&) {}
+    if (!(binary ? output.is_open() : bool(text))) {
         std::cerr << "Could not open output file.\n";
         return -2;
     }
-    // or, keep a well-defined output to cout if this ofstream doesn't work
-    // std::ostream& o = output.is_open() ? output : std::cout;
-    /* to do this, comment the `if (!output...)` block above, uncomment the line
-    *  immediately above, and also uncomment `print_map(o)` in exchange for
-    *  the line immediately below it, below. */
+    // or, to print to stdout instead, construct the output_writer on file
+    // descriptor 1: new david::io::output_writer(1)
 
-    auto numEqns = Equations().size();
+    // this run solves whichever input is current now, even if another is
+    // published before it is done
+    auto eqns = Loaded.read();
+    auto numEqns = unsigned(eqns->view.size);
+    david::math::aligned_vector<double> results (numEqns);
+    id_index index (eqns->table.max_id, numEqns);
 
-    Solutions(); // make sure this map is initialized before we go
-    unsigned first = 0, per_block = numEqns/(num_threads+1);
-    unsigned block_last = per_block;
-    std::vector<std::thread> vthread; vthread.reserve(num_threads);
-    for (unsigned b = 0; b < num_threads; ++b) {
-        vthread.emplace_back(solve_range, first, block_last, numEqns);
-        first = block_last;
-        block_last += per_block;
-    }
-    solve_range(block_last, numEqns, numEqns);
-    for (auto&& th: vthread) th.join();
+    // blocks run on the shared pool, under this thread's read-side section
+    david::thread::parallel_for_blocks(0u, numEqns,
+        [&](unsigned i, unsigned k) {
+            solve_range(*eqns, results.data(), i, k, index);
+        }, solve_grain);
+    solve_compounds(eqns->table, results.data());
 
-    //print_map(o);
-    print_map(output);
+    if (!binary) {
+        print_map(*eqns, results.data(), index, *text, 4 * pool_threads());
+        try { text->close(); }
+        catch (std::system_error& se) {
+            std::cerr << se.what() << std::endl;
+            return -3;
+        }
+    } else if (auto skipped = write_map(*eqns, results.data(), index, output))
+        std::cerr << skipped << " compound expressions have no binary form "
+            "and were left out.\n";
+    report_memo();
+    report_perf();
 
     return 0;
 }
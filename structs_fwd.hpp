@@ -20,20 +20,24 @@ namespace david {
         class thread_queue;
         template <typename T, class Container>
         class thread_stack;
-        template <typename T, class Container>
+        template <typename T, class Allocator>
         class thread_list;
-        template <typename T, class Container>
+        template <typename T, class Compare>
         class thread_forward_list;
         template <typename T, class Container, class Compare>
         class thread_priority_queue;
+        template <typename T, typename R>
+        class sequenced_queue;
+        template <typename K, typename V, class Hash, class KeyEqual>
+        class thread_map;
 
         //* non-member swap functions
         template <typename T, class C>
         void swap (thread_queue<T, C>& lhs, thread_queue<T, C>& rhs);
         template <typename T, class C>
         void swap (thread_stack<T, C>& lhs, thread_stack<T, C>& rhs);
-        template <typename T, class C>
-        void swap (thread_list<T, C>& lhs,  thread_list<T, C>& rhs);
+        template <typename T, class A>
+        void swap (thread_list<T, A>& lhs,  thread_list<T, A>& rhs);
         template <typename T, class C>
         void swap (thread_forward_list<T, C>& l, thread_forward_list<T, C>& rh);
         template <typename T, class C, class Cm>
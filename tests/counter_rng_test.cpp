@@ -0,0 +1,116 @@
+//
+//  counter_rng_test.cpp
+//  thread_support
+//
+//  Pins the streams of counter_rng.hpp: Philox4x32-10 against the known
+//  answers published with Random123 (kat_vectors, philox4x32_10), the way
+//  philox_stream lays out its counter and key, and the bulk fills against
+//  the single draws they must reproduce. make_people and generate_math
+//  output depend on all three.
+
+//  compile this file with -std=c++17 or higher.
+
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <vector>
+#include "counter_rng.hpp"
+
+using namespace david::random;
+
+TEST(Philox, KnownAnswers) {
+    using philox::block_type;
+    using philox::key_type;
+    EXPECT_EQ(philox::generate(block_type {{0, 0, 0, 0}}, key_type {{0, 0}}),
+        (block_type {{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}}));
+    EXPECT_EQ(philox::generate(
+        block_type {{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}},
+        key_type {{0xffffffff, 0xffffffff}}),
+        (block_type {{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}}));
+    EXPECT_EQ(philox::generate(
+        block_type {{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}},
+        key_type {{0xa4093822, 0x299f31d0}}),
+        (block_type {{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}}));
+}
+
+TEST(Philox, BlocksMatchGenerate) {
+    const philox::key_type key {{0x01234567, 0x89abcdef}};
+    const std::uint64_t first = 0xfffffff0, stream = 0x0123456789abcdefull;
+    std::vector<std::uint32_t> out (4 * 37);
+    philox::generate_blocks(first, stream, key, out.data(), 37);
+    for (std::uint64_t i = 0; i < 37; ++i) {
+        std::uint64_t n = first + i;
+        auto b = philox::generate(philox::block_type {{std::uint32_t(n),
+            std::uint32_t(n >> 32), std::uint32_t(stream),
+            std::uint32_t(stream >> 32)}}, key);
+        for (unsigned j = 0; j < 4; ++j)
+            EXPECT_EQ(out[4 * i + j], b[j]) << "block " << i;
+    }
+}
+
+TEST(PhiloxStream, CounterAndKeyLayout) {
+    // block n of stream s under seed k is generate({n, s}, k), low word first
+    const std::uint64_t seed = 0x0123456789abcdefull, stream = 0xfedcba98ull;
+    philox_stream s (seed, stream);
+    for (std::uint64_t n = 0; n < 3; ++n) {
+        auto b = philox::generate(philox::block_type {{std::uint32_t(n),
+            std::uint32_t(n >> 32), std::uint32_t(stream),
+            std::uint32_t(stream >> 32)}}, philox::key_type {{
+            std::uint32_t(seed), std::uint32_t(seed >> 32)}});
+        for (unsigned j = 0; j < 4; ++j) EXPECT_EQ(s(), b[j]);
+    }
+}
+
+//* Runs a bulk fill and the same number of single draws on two copies of a
+//  stream, starting @skip values in so the fill begins mid-block.
+template <class Bulk, class Single>
+void expect_same_draws(unsigned skip, std::size_t n, Bulk bulk, Single one) {
+    philox_stream a (2017, 42), b (2017, 42);
+    for (unsigned i = 0; i < skip; ++i) { a(); b(); }
+    auto got = bulk(a, n);
+    for (std::size_t i = 0; i < n; ++i)
+        ASSERT_EQ(got[i], one(b)) << "skip " << skip << ", n " << n
+            << ", at " << i;
+    EXPECT_EQ(a(), b()) << "the streams go on in step";
+}
+
+const std::size_t Sizes[] = {0, 1, 3, 4, 5, 63, 255, 256, 257, 1000, 4099};
+
+TEST(PhiloxStream, FillMatchesSingleDraws) {
+    for (unsigned skip = 0; skip < 4; ++skip)
+        for (std::size_t n : Sizes)
+            expect_same_draws(skip, n,
+                [](philox_stream& s, std::size_t m) {
+                    std::vector<std::uint32_t> v (m);
+                    s.fill(v.data(), m);
+                    return v;
+                },
+                [](philox_stream& s) { return s(); });
+}
+
+TEST(PhiloxStream, FillUniformMatchesSingleDraws) {
+    for (unsigned skip = 0; skip < 4; ++skip)
+        for (std::size_t n : Sizes)
+            expect_same_draws(skip, n,
+                [](philox_stream& s, std::size_t m) {
+                    std::vector<double> v (m);
+                    s.fill_uniform(v.data(), m, -50000.0, 50000.0);
+                    return v;
+                },
+                [](philox_stream& s) {
+                    return s.uniform(-50000.0, 50000.0);
+                });
+}
+
+TEST(PhiloxStream, FillBoundedMatchesSingleDraws) {
+    for (unsigned skip = 0; skip < 4; ++skip)
+        for (std::size_t n : Sizes)
+            expect_same_draws(skip, n,
+                [](philox_stream& s, std::size_t m) {
+                    std::vector<std::uint16_t> v (m);
+                    s.fill_bounded(v.data(), m, 20000);
+                    return v;
+                },
+                [](philox_stream& s) {
+                    return std::uint16_t(s.bounded(20000));
+                });
+}
@@ -0,0 +1,250 @@
+//
+//  thread_forward_list.hpp
+//  thread_support
+//
+//*  A lock-free sorted singly linked list, holding each value at most once:
+//*  Harris's list (DISC 2001) as Michael made it safe to free nodes from
+//*  (SPAA 2002). Erasing a node first sets a mark in the low bit of its
+//*  next pointer, which stops anyone linking after it, and only then
+//*  unlinks it; a thread that meets a marked node on its way helps unlink
+//*  it. Unlinked nodes are handed to epoch-based reclamation (epoch.hpp),
+//*  so a reader still standing on one never sees it freed. No operation
+//*  takes a lock: contains() and for_each() only read, and a writer only
+//*  retries its compare-and-swap when another writer got to the same link
+//*  first. Lookups are linear, so this suits small to medium sets that are
+//*  mostly read, e.g. which IDs have already been seen.
+//*  Compile with -std=c++17 or higher (epoch.hpp uses aligned new).
+
+#ifndef thread_forward_list_hpp
+#define thread_forward_list_hpp
+
+#include "structs_fwd.hpp"
+#include "epoch.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <functional> // std::less
+
+namespace david {
+    namespace thread {
+        template <typename T, class Compare = std::less<T> >
+        class thread_forward_list {
+        //* public member type aliases
+        public:
+            using value_type      = T;
+            using value_compare   = Compare;
+            using reference       = value_type&;
+            using const_reference = const value_type&;
+            using size_type       = std::size_t;
+        private:
+            //* A link: a node pointer, whose low bit marks its owner erased.
+            using link = std::atomic<std::uintptr_t>;
+
+            struct node {
+                const T mData;
+                link    mNext;
+                template <typename... Args>
+                explicit node(Args&&... args)
+                : mData(std::forward<Args>(args)...), mNext(0) {}
+            };
+
+            link          mHead;
+            value_compare mComp;
+            //* Convenience typedefs
+            using guard = epoch::guard;
+
+            static node* ptr(std::uintptr_t l) {
+                return reinterpret_cast<node*>(l & ~std::uintptr_t(1));
+            }
+            static bool marked(std::uintptr_t l) { return l & 1; }
+            static std::uintptr_t word(node* n) {
+                return reinterpret_cast<std::uintptr_t>(n);
+            }
+
+            bool equal(const T& a, const T& b) const {
+                return !mComp(a, b) && !mComp(b, a);
+            }
+
+            //* Where find() stopped: *prev held cur, the first node >= key.
+            struct position {
+                link* prev;
+                node* cur;
+            };
+
+            /*  Michael's search: walks to the first node not less than
+            *   @param key, unlinking (and retiring) every marked node on the
+            *   way, and starting over when a link it read has changed.
+            *   Must be called inside an epoch guard. */
+            position find(const T& key) {
+            retry:
+                link* prev = &mHead;
+                node* cur = ptr(prev->load(std::memory_order_acquire));
+                while (cur) {
+                    std::uintptr_t next = cur->mNext.load(
+                        std::memory_order_acquire);
+                    if (marked(next)) {
+                        // cur is being erased: help unlink it
+                        std::uintptr_t expected = word(cur);
+                        if (!prev->compare_exchange_strong(expected,
+                            next & ~std::uintptr_t(1),
+                            std::memory_order_acq_rel,
+                            std::memory_order_acquire))
+                            goto retry;
+                        epoch::domain::instance().retire(cur);
+                        cur = ptr(next);
+                        continue;
+                    }
+                    if (!mComp(cur->mData, key)) return position {prev, cur};
+                    prev = &cur->mNext;
+                    cur = ptr(next);
+                }
+                return position {prev, nullptr};
+            }
+
+        public:
+            //* Default constructor. Constructs empty thread_forward_list.
+            explicit thread_forward_list(const value_compare& comp =
+                value_compare())
+            : mHead(0), mComp(comp) {}
+
+            //* Copy construction and assignment are deleted.
+            thread_forward_list(const thread_forward_list&) = delete;
+            thread_forward_list& operator=(const thread_forward_list&) = delete;
+
+            /*  Frees every node still linked; no other thread may be using
+            *   the list. Nodes already unlinked belong to the epoch domain. */
+            ~thread_forward_list() {
+                for (node* n = ptr(mHead.load()); n; ) {
+                    node* next = ptr(n->mNext.load());
+                    delete n;
+                    n = next;
+                }
+            }
+
+            /** Adds @param val in order, unless an equal value is there.
+            *   @return: whether it was added */
+            bool insert(value_type val) {
+                guard g;
+                node* n = nullptr;
+                for (;;) {
+                    position pos = find(val);
+                    if (pos.cur && equal(pos.cur->mData, val)) {
+                        delete n;
+                        return false;
+                    }
+                    if (!n) n = new node(std::move_if_noexcept(val));
+                    n->mNext.store(word(pos.cur), std::memory_order_relaxed);
+                    std::uintptr_t expected = word(pos.cur);
+                    // fails if prev changed or its owner has been marked
+                    if (pos.prev->compare_exchange_strong(expected, word(n),
+                        std::memory_order_release, std::memory_order_relaxed))
+                        return true;
+                }
+            }
+
+            /** Removes the value equal to @param key.
+            *   @return: whether there was one (and this call removed it) */
+            bool erase(const value_type& key) {
+                guard g;
+                for (;;) {
+                    position pos = find(key);
+                    if (!pos.cur || !equal(pos.cur->mData, key)) return false;
+                    std::uintptr_t next = pos.cur->mNext.load(
+                        std::memory_order_acquire);
+                    if (marked(next)) continue; // someone else is erasing it
+                    // the mark is the erase; unlinking is tidying up
+                    if (!pos.cur->mNext.compare_exchange_strong(next, next | 1,
+                        std::memory_order_acq_rel, std::memory_order_relaxed))
+                        continue;
+                    std::uintptr_t expected = word(pos.cur);
+                    if (pos.prev->compare_exchange_strong(expected, next,
+                        std::memory_order_acq_rel, std::memory_order_relaxed))
+                        epoch::domain::instance().retire(pos.cur);
+                    else
+                        find(key); // leaves unlinking it to the search
+                    return true;
+                }
+            }
+
+            /** @return: whether a value equal to @param key is in the list.
+            *   Wait-free: it only reads, and never restarts. */
+            bool contains(const value_type& key) const {
+                guard g;
+                node* cur = ptr(mHead.load(std::memory_order_acquire));
+                while (cur && mComp(cur->mData, key))
+                    cur = ptr(cur->mNext.load(std::memory_order_acquire));
+                return cur && equal(cur->mData, key)
+                    && !marked(cur->mNext.load(std::memory_order_acquire));
+            }
+
+            /** Calls @param fn(const T&) on every value, in order. Values
+            *   inserted or erased meanwhile may or may not be visited, but
+            *   none is visited twice or out of order. Writers never wait for
+            *   it, so @param fn may itself insert into or erase from the
+            *   list (it sees its own changes ahead of it). */
+            template <class Function>
+            void for_each(Function fn) const {
+                guard g;
+                node* cur = ptr(mHead.load(std::memory_order_acquire));
+                while (cur) {
+                    std::uintptr_t next = cur->mNext.load(
+                        std::memory_order_acquire);
+                    if (!marked(next)) fn(cur->mData);
+                    cur = ptr(next);
+                }
+            }
+
+            /** @return: number of values, counted by a walk (so only exact
+            *   while no one is writing) */
+            size_type size() const {
+                size_type n = 0;
+                for_each([&n](const T&) { ++n; });
+                return n;
+            }
+
+            /** @return: whether the current thread_forward_list is empty */
+            bool empty() const {
+                guard g;
+                node* cur = ptr(mHead.load(std::memory_order_acquire));
+                while (cur) {
+                    std::uintptr_t next = cur->mNext.load(
+                        std::memory_order_acquire);
+                    if (!marked(next)) return false;
+                    cur = ptr(next);
+                }
+                return true;
+            }
+
+            /** Equality comparison: @returns true iff the addresses of the
+            *   two thread_forward_lists are the same, i.e. they refer to the
+            *   same object */
+            friend bool operator==(const thread_forward_list& a,
+                const thread_forward_list& b)
+            {
+                return &a == &b;
+            }
+
+            /** Swaps the nodes of the two lists. Not atomic: a list's head
+            *   can't be swapped in one step with another's, so neither may
+            *   be in use by other threads meanwhile.
+            *   @param <rhs>: thread_forward_list to swap with *this */
+            void swap(thread_forward_list& rhs) {
+                if (this == &rhs) return;
+                std::uintptr_t head = mHead.load();
+                mHead.store(rhs.mHead.load());
+                rhs.mHead.store(head);
+                using std::swap;
+                swap(mComp, rhs.mComp);
+            }
+        };
+
+        template <typename T, class C>
+        inline void swap (thread_forward_list<T, C>& lhs,
+            thread_forward_list<T, C>& rhs)
+        {
+            lhs.swap(rhs);
+        }
+    }
+}
+
+#endif /* thread_forward_list_hpp */
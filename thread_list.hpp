@@ -0,0 +1,235 @@
+//
+//  thread_list.hpp
+//  thread_support
+//
+//*  A thread-safe singly linked list with a mutex per node, based on that
+//*  in Anthony Williams's "C++ Concurrency in Action" (section 6.3.2).
+//*  Every operation walks the list hand over hand: it locks the next node
+//*  before letting go of the current one, so threads working on different
+//*  parts of the list never wait for each other, and none can overtake
+//*  another. Nodes come from @tparam Allocator (rebound to the node type).
+
+#ifndef thread_list_hpp
+#define thread_list_hpp
+
+#include "structs_fwd.hpp"
+#include <memory>  // std::allocator, std::allocator_traits, std::shared_ptr
+#include <mutex>
+
+namespace david {
+    namespace thread {
+        template <typename T, class Allocator = std::allocator<T> >
+        class thread_list {
+        //* public member type aliases
+        public:
+            using allocator_type  = Allocator;
+            using value_type      = T;
+            using reference       = value_type&;
+            using const_reference = const value_type&;
+            using pointer         = std::shared_ptr<T>;
+            using size_type       = std::size_t;
+        private:
+            struct node;
+            //* What the head and every node have: a lock and a successor.
+            struct link {
+                mutable std::mutex mMut;
+                node* mNext = nullptr;
+            };
+            struct node : link {
+                T mData;
+                template <typename... Args>
+                explicit node(Args&&... args)
+                : mData(std::forward<Args>(args)...) {}
+            };
+            using node_alloc = typename std::allocator_traits<Allocator>::
+                template rebind_alloc<node>;
+            using node_traits = std::allocator_traits<node_alloc>;
+
+            link       mHead;     // its mNext is the first node
+            node_alloc mAlloc;
+            //* Convenience typedefs
+            using LGuard = std::lock_guard<std::mutex>;
+            using ULock = std::unique_lock<std::mutex>;
+
+            template <typename... Args>
+            node* make_node(Args&&... args) {
+                node* n = node_traits::allocate(mAlloc, 1);
+                try {
+                    node_traits::construct(mAlloc, n,
+                        std::forward<Args>(args)...);
+                } catch (...) {
+                    node_traits::deallocate(mAlloc, n, 1);
+                    throw;
+                }
+                return n;
+            }
+
+            void destroy_node(node* n) {
+                node_traits::destroy(mAlloc, n);
+                node_traits::deallocate(mAlloc, n, 1);
+            }
+
+            /*  Walks the list hand over hand, calling @param fn(prev, cur,
+            *   cur_lock) with both prev and cur locked, until fn returns
+            *   false. fn may unlink cur, which it then owns, as long as it
+            *   leaves cur_lock unlocked. */
+            template <class Fn>
+            void walk(Fn fn) {
+                ULock prev_lock(mHead.mMut);
+                link* prev = &mHead;
+                while (node* cur = prev->mNext) {
+                    ULock cur_lock(cur->mMut);
+                    if (!fn(prev, cur, cur_lock)) return;
+                    if (prev->mNext != cur) continue; // cur was unlinked
+                    prev_lock.unlock();
+                    prev = cur;
+                    prev_lock = std::move(cur_lock);
+                }
+            }
+
+        public:
+            //* Default constructor. Constructs empty thread_list.
+            explicit thread_list(const allocator_type& alloc = allocator_type())
+            : mHead(), mAlloc(alloc) {}
+
+            //* Copy construction and assignment are deleted.
+            thread_list(const thread_list&) = delete;
+            thread_list& operator=(const thread_list&) = delete;
+
+            //* Frees every node, front to back, without recursion.
+            ~thread_list() {
+                for (node* n = mHead.mNext; n; ) {
+                    node* next = n->mNext;
+                    destroy_node(n);
+                    n = next;
+                }
+            }
+
+            /** Adds @param val to the front of the list.
+            *   @param <val>: value to be added */
+            void push_front(value_type val) {
+                node* n = make_node(std::move_if_noexcept(val));
+                LGuard lk(mHead.mMut);
+                n->mNext = mHead.mNext;
+                mHead.mNext = n;
+            }
+
+            /** Emplacement function.
+            *   @param <args>: arguments to construct the new front from */
+            template <typename... Args>
+            void emplace_front(Args&&... args) {
+                node* n = make_node(std::forward<Args>(args)...);
+                LGuard lk(mHead.mMut);
+                n->mNext = mHead.mNext;
+                mHead.mNext = n;
+            }
+
+            /** Calls @param fn(T&) on every element, front to back, with
+            *   that element's node locked. */
+            template <class Function>
+            void for_each(Function fn) {
+                walk([&fn](link*, node* cur, ULock&) {
+                    fn(cur->mData);
+                    return true;
+                });
+            }
+
+            /** @return: a copy of the first element for which @param p(T&)
+            *   is true, or an empty pointer if there is none. */
+            template <class Predicate>
+            pointer find_first_if(Predicate p) {
+                pointer found;
+                walk([&](link*, node* cur, ULock&) {
+                    if (!p(cur->mData)) return true;
+                    found = std::allocate_shared<T>(mAlloc, cur->mData);
+                    return false;
+                });
+                return found;
+            }
+
+            /** find_first_if() overload copying the element into @param value.
+            *   @return: whether one was found */
+            template <class Predicate>
+            bool find_first_if(Predicate p, value_type& value) {
+                bool found = false;
+                walk([&](link*, node* cur, ULock&) {
+                    if (!p(cur->mData)) return true;
+                    value = cur->mData;
+                    found = true;
+                    return false;
+                });
+                return found;
+            }
+
+            /** Removes every element for which @param p(T&) is true.
+            *   @return: how many were removed */
+            template <class Predicate>
+            size_type remove_if(Predicate p) {
+                size_type removed = 0;
+                walk([&](link* prev, node* cur, ULock& cur_lock) {
+                    if (!p(cur->mData)) return true;
+                    // no one else can reach cur: they would need prev's lock
+                    prev->mNext = cur->mNext;
+                    cur_lock.unlock();
+                    destroy_node(cur);
+                    ++removed;
+                    return true;
+                });
+                return removed;
+            }
+
+            /** Inserts @param val after the first element for which
+            *   @param p(T&) is true.
+            *   @return: whether there was such an element */
+            template <class Predicate>
+            bool insert_after(Predicate p, value_type val) {
+                node* n = make_node(std::move_if_noexcept(val));
+                bool done = false;
+                walk([&](link*, node* cur, ULock&) {
+                    if (!p(cur->mData)) return true;
+                    n->mNext = cur->mNext;
+                    cur->mNext = n;
+                    done = true;
+                    return false;
+                });
+                if (!done) destroy_node(n);
+                return done;
+            }
+
+            /** @return: whether the current thread_list is empty */
+            bool empty() const {
+                LGuard lk(mHead.mMut);
+                return mHead.mNext == nullptr;
+            }
+
+            /** Equality comparison: @returns true iff the addresses of the
+            *   two thread_lists are the same, i.e. they refer to the same
+            *   object */
+            friend bool operator==(const thread_list& a, const thread_list& b)
+            {
+                return &a == &b;
+            }
+
+            /** A transactional swap member function: the two lists trade
+            *   their nodes. Threads already past the head of either list
+            *   finish their walk on the nodes they were on.
+            *   @param <rhs>: thread_list to swap with *this */
+            void swap(thread_list& rhs) {
+                if (this == &rhs) return;
+                std::lock(mHead.mMut, rhs.mHead.mMut);
+                LGuard lock_a(mHead.mMut,     std::adopt_lock);
+                LGuard lock_b(rhs.mHead.mMut, std::adopt_lock);
+                std::swap(mHead.mNext, rhs.mHead.mNext);
+                using std::swap;
+                swap(mAlloc, rhs.mAlloc);
+            }
+        };
+
+        template <typename T, class A>
+        inline void swap (thread_list<T, A>& lhs, thread_list<T, A>& rhs) {
+            lhs.swap(rhs);
+        }
+    }
+}
+
+#endif /* thread_list_hpp */
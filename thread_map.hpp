@@ -0,0 +1,209 @@
+//
+//  thread_map.hpp
+//  thread_support
+//
+//*  A thread-safe hash map with lock striping. Keys are spread by hash over
+//*  a fixed number of stripes, each an ordinary hash table behind its own
+//*  reader/writer lock: lookups of one stripe share its lock, and writers
+//*  only exclude the threads working on the same stripe. A stripe grows
+//*  (rehashes) on its own, under its own lock, so a resize never stops the
+//*  rest of the map. Values are handed out by copy, or worked on in place
+//*  through update(), never by reference, since a reference would outlive
+//*  the lock that protects it.
+//*  Compile with -std=c++17 or higher (std::shared_mutex, aligned new).
+
+#ifndef thread_map_hpp
+#define thread_map_hpp
+
+#include "structs_fwd.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <functional>    // std::hash, std::equal_to
+#include <unordered_map>
+#include <memory>        // std::unique_ptr
+#include <mutex>
+#include <shared_mutex>  // std::shared_mutex, std::shared_lock
+
+namespace david {
+    namespace thread {
+        template <typename K, typename V, class Hash = std::hash<K>,
+            class KeyEqual = std::equal_to<K> >
+        class thread_map {
+        //* public member type aliases
+        public:
+            using key_type    = K;
+            using mapped_type = V;
+            using value_type  = std::pair<const K, V>;
+            using hasher      = Hash;
+            using key_equal   = KeyEqual;
+            using size_type   = std::size_t;
+        private:
+            using table_type = std::unordered_map<K, V, Hash, KeyEqual>;
+
+            //* One stripe per cache line, so neighbours' locks don't share one.
+            struct alignas(64) stripe {
+                mutable std::shared_mutex mut;
+                table_type table;
+            };
+
+            std::unique_ptr<stripe[]> mStripes;
+            size_type mStripeCount;
+            unsigned  mShift;      // stripe = mixed hash >> mShift
+            hasher    mHash;
+            //* Convenience typedefs
+            using SLock = std::shared_lock<std::shared_mutex>;
+            using XLock = std::unique_lock<std::shared_mutex>;
+
+            /*  Picks the stripe from the top bits of the mixed hash, leaving
+            *   the low bits, which the stripe's table buckets on, unrelated
+            *   to the stripe (std::hash of an integer is often itself). */
+            stripe& stripe_of(const key_type& key) const {
+                std::uint64_t h = mHash(key);
+                h ^= h >> 33; h *= 0xff51afd7ed558ccdull; h ^= h >> 33;
+                h *= 0xc4ceb9fe1a85ec53ull; h ^= h >> 33;
+                return mStripes[mShift == 64 ? 0 : h >> mShift];
+            }
+
+        public:
+            /** Constructs an empty thread_map.
+            *   @param <stripes>: number of locks, rounded up to a power of 2;
+            *   a few per thread keeps writers from meeting often.
+            *   @param <buckets>: initial buckets across all stripes. */
+            explicit thread_map(size_type stripes = 64, size_type buckets = 0,
+                const hasher& hash = hasher())
+            : mStripeCount(1), mShift(64), mHash(hash)
+            {
+                while (mStripeCount < stripes) {
+                    mStripeCount <<= 1; --mShift;
+                }
+                mStripes.reset(new stripe[mStripeCount]);
+                for (size_type s = 0; s < mStripeCount; ++s)
+                    mStripes[s].table = table_type(buckets / mStripeCount,
+                        hash);
+            }
+
+            //* Copying and moving are deleted; readers hold stripe addresses.
+            thread_map(const thread_map&) = delete;
+            thread_map& operator=(const thread_map&) = delete;
+
+            //* Explicitly defaulted destructor; thank you RAII
+            ~thread_map() = default;
+
+            /** Copies the value at @param key into @param value.
+            *   @return: whether the key was found */
+            bool find(const key_type& key, mapped_type& value) const {
+                auto&& s = stripe_of(key);
+                SLock lk(s.mut);
+                auto it = s.table.find(key);
+                if (it == s.table.end()) return false;
+                value = it->second;
+                return true;
+            }
+
+            /** @return: whether @param key is in the map */
+            bool contains(const key_type& key) const {
+                auto&& s = stripe_of(key);
+                SLock lk(s.mut);
+                return s.table.find(key) != s.table.end();
+            }
+
+            /** Adds @param key with @param value unless the key is there.
+            *   @return: whether it was added */
+            bool insert(const key_type& key, mapped_type value) {
+                auto&& s = stripe_of(key);
+                XLock lk(s.mut);
+                return s.table.emplace(key, std::move_if_noexcept(value))
+                    .second;
+            }
+
+            /** Sets @param key to @param value, adding the key if needed.
+            *   @return: whether it was added */
+            bool insert_or_assign(const key_type& key, mapped_type value) {
+                auto&& s = stripe_of(key);
+                XLock lk(s.mut);
+                auto res = s.table.emplace(key, value);
+                if (!res.second)
+                    res.first->second = std::move_if_noexcept(value);
+                return res.second;
+            }
+
+            /** Calls @param fn(mapped_type&) on the value at @param key,
+            *   under the lock of its stripe, so the update is atomic.
+            *   @return: whether the key was found */
+            template <class Fn>
+            bool update(const key_type& key, Fn fn) {
+                auto&& s = stripe_of(key);
+                XLock lk(s.mut);
+                auto it = s.table.find(key);
+                if (it == s.table.end()) return false;
+                fn(it->second);
+                return true;
+            }
+
+            /** As update(key, fn), except that a missing key is added with
+            *   @param init instead (and fn is not called).
+            *   @return: whether the key was added */
+            template <class Fn>
+            bool update(const key_type& key, Fn fn, mapped_type init) {
+                auto&& s = stripe_of(key);
+                XLock lk(s.mut);
+                auto res = s.table.emplace(key, std::move_if_noexcept(init));
+                if (!res.second) fn(res.first->second);
+                return res.second;
+            }
+
+            /** Removes @param key.
+            *   @return: whether it was there */
+            bool erase(const key_type& key) {
+                auto&& s = stripe_of(key);
+                XLock lk(s.mut);
+                return s.table.erase(key) != 0;
+            }
+
+            /** Calls @param fn(const key_type&, const mapped_type&) for every
+            *   element, one stripe at a time under its shared lock. Writers
+            *   may change stripes already or not yet visited meanwhile. */
+            template <class Fn>
+            void for_each(Fn fn) const {
+                for (size_type i = 0; i < mStripeCount; ++i) {
+                    auto&& s = mStripes[i];
+                    SLock lk(s.mut);
+                    for (auto&& kv : s.table) fn(kv.first, kv.second);
+                }
+            }
+
+            /** @return: number of elements, summed stripe by stripe (so
+            *   only exact while no one is writing) */
+            size_type size() const {
+                size_type n = 0;
+                for (size_type i = 0; i < mStripeCount; ++i) {
+                    SLock lk(mStripes[i].mut);
+                    n += mStripes[i].table.size();
+                }
+                return n;
+            }
+
+            bool empty() const { return size() == 0; }
+
+            //* Removes every element, one stripe at a time.
+            void clear() {
+                for (size_type i = 0; i < mStripeCount; ++i) {
+                    XLock lk(mStripes[i].mut);
+                    mStripes[i].table.clear();
+                }
+            }
+
+            size_type stripes() const noexcept { return mStripeCount; }
+
+            /** Equality comparison: @returns true iff the addresses of the
+            *   two thread_maps are the same, i.e. they refer to the same
+            *   object */
+            friend bool operator==(const thread_map& a, const thread_map& b)
+            {
+                return &a == &b;
+            }
+        };
+    }
+}
+
+#endif /* thread_map_hpp */
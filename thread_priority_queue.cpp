@@ -14,90 +14,280 @@
 //  described in the file.
 //  The next X lines are in the format A    M, where A is a non-negative integer
 //  age for the person and M is a string for their name.
+//  Binary people files (make_people -b, see people.hpp) are read too.
+//  With -r (or --radix) before argv[1], all files are parsed in parallel first
+//  and then radix sorted, instead of being sorted online through the queue.
+//  With -p (or --perf), the sort is counted with perf_counters.hpp: online,
+//  each reader's pushes and the main thread's pops; offline, the radix sort
+//  with its workers. The counts per record are reported at the end.
 
 #include <iostream>
 #include <fstream>
-#include <sstream>
 #include <string>
 #include <thread>
 #include <future>
 #include <chrono>
+#include <atomic>
 #include <algorithm>
 #include "thread_priority_queue.hpp"
+#include "radix_sort.hpp"
+#include "people.hpp"
+#include "output_writer.hpp"
+#include "perf_counters.hpp"
 
-using namespace std::rel_ops; // give me a <=, >, >=, !=, etc., based on <
 using namespace david::thread;
+using namespace david::people;
+using namespace david::io;
 
-typedef unsigned short ushort;
-typedef unsigned char  uchar;  // for laziness
+/*  A Person is a person_record in the arena: a packed age key and two
+*   interned names. The queue itself only holds (key, index) pairs. */
+name_table   Names;
+person_arena Arena;
+thread_priority_queue<heap_entry> People_Queue;
 
-struct Person
-{
-    struct Age {
-        unsigned short years;
-        unsigned char  months, days;
-        Age(ushort y, uchar m = 0, uchar d = 0): years(y), months(m), days(d) {}
-    } age;
-    std::string name;
-    Person() : age(0) {};
-    template <typename stringTp>
-    Person(ushort y, uchar m, uchar d, stringTp&& n)
-    : age(y, m, d), name(std::forward<stringTp>(n)) {};
-};
-
-inline bool operator==(const struct Person::Age&a, const struct Person::Age&b) {
-    return a.years == b.years && a.months == b.months && a.days == b.days;
-};
-
-inline bool operator<(const struct Person::Age& a, const struct Person::Age& b){
-    return a.years < b.years || (a.years == b.years && a.months < b.months)
-        ||  (a.years == b.years && a.months == b.months && a.days < b.days);
-};
-
-inline
-bool operator< (const Person& a, const Person& b) { return a.age < b.age; };
-
-inline bool operator==(const Person& a, const Person& b) {
-    return a.name == b.name && a.age == b.age;
-};
-
-inline std::ostream& operator<< (std::ostream& o, const struct Person::Age& a) {
-    o << a.years << ' ' << ushort(a.months) << ' ' << ushort(a.days);
-    return o;
-};
-
-inline std::ostream& operator<< (std::ostream& o, const Person& p) {
-    o << p.name << ";\t" << p.age;
-    return o;
-}
+perf::region Online_Perf  ("online", false);           // enabled by -p
+perf::region Offline_Perf ("offline radix", false, true);
+
+std::atomic<unsigned> countIn {0};
+std::atomic<unsigned> readersLeft {0};
 
-thread_priority_queue<Person> People_Queue;
+/*  Reads the declared count on the first line at @p, leaving @p at the start
+*   of the records. A missing or malformed count reads as 0, and a count
+*   larger than the rest of the file has room for is cut down to that. */
+inline unsigned read_count(const char*& p, const char* last) {
+    unsigned N = 0;
+    if (!parse_int(p, last, N)) N = 0;
+    p = next_line(p, last);
+    // the last line may lack its newline
+    return unsigned(std::min<std::size_t>(N,
+        (last - p + 1) / min_person_line));
+}
 
-unsigned countIn = 0;
+/*  Copies the records of a binary people file (make_people -b) into the
+*   arena block for @source, interning its names, and hands each (key, index)
+*   pair to @sink. Records naming a name the file lacks are skipped; they
+*   are counted first, so the block is sized once, before it is published. */
+template <class Sink>
+inline void read_people_file(const mapped_file& in, unsigned source,
+    Sink&& sink)
+{
+    unsigned x = 0;
+    try {
+        people_file file (in);
+        std::cout << file.size() << '\n';
+        std::vector<name_id> ids;
+        for (auto&& name : file.names()) ids.push_back(Names.intern(name));
+        auto valid = [&ids](const person_record& r) {
+            return r.first < ids.size() && r.last < ids.size();
+        };
+        auto&& block = Arena.allocate(source, std::count_if(
+            file.records(), file.records() + file.size(), valid));
+        for (std::size_t i = 0; i < file.size(); ++i) {
+            const person_record& r = file.records()[i];
+            if (!valid(r)) continue;
+            block[x] = person_record {r.key, ids[r.first], ids[r.last]};
+            sink(heap_entry {r.key, person_arena::index(source, x)});
+            ++x;
+        }
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+    countIn += x;
+}
 
-inline void read_n_people(std::istream& ifs) {
-    int N, x = 0;
+/*  Parses up to the declared number of people from @in into the arena block
+*   for @source, handing each (key, index) pair to @sink as it goes. A file
+*   with fewer people than it declares leaves the rest of the block unused:
+*   the rows already handed on may be read while it parses, so the block is
+*   never resized. */
+template <class Sink>
+inline void read_n_people(const mapped_file& in, unsigned source, Sink&& sink)
+{
+    const char* p = in.begin(), * last = in.end();
     std::cout << "0x" << std::hex << std::this_thread::get_id() << ": "
         << std::dec << std::flush;
-    ifs >> N; countIn += N;
+    if (is_people_file(in)) {
+        read_people_file(in, source, sink);
+        return;
+    }
+    unsigned N = read_count(p, last), x = 0;
     std::cout << N << '\n';
-    std::string curr, name, name2;
-    unsigned short age, mo, dy;
-    while (std::getline(ifs, curr) && x++ <= N) {
-        std::stringstream ss(curr);
-        ss >> age >> mo >> dy >> name >> name2;
-        People_Queue.emplace(age, mo, dy, std::move(name + " " + name2));
+    try {
+        auto&& block = Arena.allocate(source, N);
+        name_cache names(Names);
+        while (x < N && p != last) {
+            if (!parse_person(p, last, block[x], names))
+                continue; // a blank or malformed line
+            sink(heap_entry {block[x].key, person_arena::index(source, x)});
+            ++x;
+        }
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+    countIn += x;
+}
+
+/*  Maps @path, reporting (rather than throwing) a file that can't be read. */
+inline mapped_file open_input(const std::string& path) {
+    try { return mapped_file(path); }
+    catch (std::system_error& se) {
+        std::cerr << se.what() << std::endl;
+        return mapped_file();
+    }
+}
+
+bool pread_n_people(const std::string* path, unsigned source) {
+    mapped_file in = open_input(*path);
+    perf::scope counted (Online_Perf);
+    std::uint64_t pushed = 0;
+    read_n_people(in, source, [&pushed](heap_entry&& e) {
+        People_Queue.push(std::move(e));
+        ++pushed;
+    });
+    counted.ops(pushed);
+    --readersLeft;
+    return !in.empty();
+}
+
+/*  Writes [first, last) in the output format. The range is split into one
+*   part per thread, each formatted into its own lane of @out on the shared
+*   task_pool, and @out writes the lanes back in order. */
+template <class Iter>
+void write_people(output_writer& out, Iter first, Iter last) {
+    const std::vector<std::string> names = Names.snapshot();
+    std::size_t n = last - first, parts = std::min<std::size_t>(
+        default_chunks(), n / 4096 + 1);
+    auto write_part = [&](std::size_t part) {
+        auto o = out.open_lane(part);
+        for (auto it = first + n * part / parts,
+            end = first + n * (part + 1) / parts; it != end; ++it)
+            write_person(o, Arena[it->index], names) << '\n';
+    };
+    parallel_for(std::size_t(0), parts, write_part, std::size_t(1));
+}
+
+/*  Online mode: readers push into People_Queue while the main thread pops,
+*   oldest first, until every reader is done and the queue is drained. */
+void sort_online(const std::vector<std::string>& paths, output_writer& output)
+{
+    unsigned N = paths.size();
+    std::vector<std::thread> inputs (N);
+    readersLeft = N;
+    for (unsigned x = 0; x < N; ++x) {
+        inputs[x] = std::thread(pread_n_people, &paths[x], x);
+    }
+    heap_entry p;
+    auto o = output.open_lane(0);
+    {
+        perf::scope counted (Online_Perf);
+        while (true) {
+            if (People_Queue.wait_for_and_pop(p, std::chrono::milliseconds(10)))
+                write_person(o, Arena[p.index], Names) << '\n';
+            else if (readersLeft == 0 && People_Queue.empty())
+                break;
+        }
+        counted.ops(countIn); // every reader is done, and all were popped
     }
+    for (auto&& th: inputs) th.join();
 }
 
-bool pread_n_people(std::istream* piss) {
-    if (!piss /*|| piss->fail()*/) return false;
-    read_n_people(*piss);
-    return true;
+/*  Offline mode: split every file into newline-aligned chunks and parse all
+*   of them in parallel, then radix sort the (key, index) pairs. Sorting on
+*   ~key puts the oldest first, and the sort is stable, so equal ages keep
+*   their input order (file, then line). */
+void sort_offline(const std::vector<std::string>& paths, output_writer& output)
+{
+    struct chunk_task {
+        unsigned source;
+        text_chunk text;
+        std::vector<person_record> records;
+        std::size_t take, block_offset, entry_offset;
+    };
+    unsigned N = paths.size();
+    std::vector<mapped_file> inputs;
+    inputs.reserve(N); // the binary readers hold on to their elements
+    std::vector<unsigned> declared (N);
+    std::vector<chunk_task> tasks;
+    task_group binary_readers;
+    std::vector<bool> binary (N);
+    for (unsigned x = 0; x < N; ++x) {
+        inputs.push_back(open_input(paths[x]));
+        if ((binary[x] = is_people_file(inputs[x]))) {
+            // already packed: copied whole, alongside the text parsing
+            binary_readers.run([&inputs, x]() {
+                read_people_file(inputs[x], x, [](heap_entry&&) {});
+            });
+            continue;
+        }
+        const char* p = inputs[x].begin(), * last = inputs[x].end();
+        declared[x] = read_count(p, last);
+        for (auto&& c : split_lines(p, last, default_chunks()))
+            tasks.push_back(chunk_task {x, c, {}, 0, 0, 0});
+    }
+
+    auto run_tasks = [&tasks](auto&& fn) {
+        parallel_for(std::size_t(0), tasks.size(),
+            [&](std::size_t i) { fn(tasks[i]); }, std::size_t(1));
+    };
+
+    run_tasks([](chunk_task& t) {
+        // one per task: the pool's threads outlive the views into inputs
+        name_cache names(Names);
+        person_record r;
+        for (const char* p = t.text.first; p != t.text.last; )
+            if (parse_person(p, t.text.last, r, names))
+                t.records.push_back(r);
+    });
+    binary_readers.wait();
+
+    // keep at most the declared count per file, in chunk order
+    std::vector<std::size_t> filled (N), base (N + 1);
+    for (auto&& t : tasks) {
+        t.take = std::min<std::size_t>(t.records.size(),
+            declared[t.source] - filled[t.source]);
+        t.block_offset = filled[t.source];
+        filled[t.source] += t.take;
+    }
+    for (unsigned x = 0; x < N; ++x) {
+        if (binary[x]) filled[x] = Arena.block(x).size();
+        else           Arena.allocate(x, filled[x]);
+        base[x + 1] = base[x] + filled[x];
+    }
+    std::vector<heap_entry> entries (base[N]);
+    for (unsigned x = 0; x < N; ++x)
+        for (std::size_t row = 0; binary[x] && row < filled[x]; ++row)
+            entries[base[x] + row] = heap_entry {Arena.block(x)[row].key,
+                person_arena::index(x, unsigned(row))};
+    run_tasks([&](chunk_task& t) {
+        auto&& block = Arena.block(t.source);
+        for (std::size_t i = 0; i < t.take; ++i) {
+            std::size_t row = t.block_offset + i;
+            block[row] = t.records[i];
+            entries[base[t.source] + row] = heap_entry {t.records[i].key,
+                person_arena::index(t.source, unsigned(row))};
+        }
+        std::vector<person_record>().swap(t.records);
+    });
+    for (unsigned x = 0; x < N; ++x)
+        if (!binary[x]) countIn += filled[x]; // binary files counted already
+
+    {
+        perf::scope counted (Offline_Perf, entries.size());
+        auto by_age = [](const heap_entry& e) { return ~e.key; };
+        if (Offline_Perf.enabled()) {
+            // a pool of its own, started and joined inside the scope, so
+            // that the counters take in its workers too
+            task_pool pool (task_pool::shared().concurrency() - 1);
+            parallel_radix_sort(entries, by_age, pool);
+        } else parallel_radix_sort(entries, by_age);
+    }
+    write_people(output, entries.begin(), entries.end());
 }
 
 inline void error() {
-    std::cerr << "Usage: ./age_sort <num> <output> {files}:\n"
+    std::cerr << "Usage: ./age_sort [-r] [-p] <num> <output> {files}:\n"
+        << "-r (--radix) parses every file first, then radix sorts them.\n"
+        << "-p (--perf) reports hardware counters for the sort.\n"
         << "<num> is a number 1-31 of files to read names and ages from.\n"
         << "<output> is a file to write results to.\n"
         << "{files} is a list of <num> files to use as inputs.\n";
@@ -105,45 +295,42 @@ inline void error() {
 
 int main(int argc, char* argv[])
 {
+    bool offline = false, counted = false;
+    for (; argc > 1 && argv[1][0] == '-'; --argc, ++argv) {
+        std::string flag (argv[1]);
+        if (flag == "-r" || flag == "--radix") offline = true;
+        else if (flag == "-p" || flag == "--perf") counted = true;
+        else break;
+    }
+    Online_Perf.enable(counted && !offline);
+    Offline_Perf.enable(counted && offline);
     // You're going to get seg faults if you do this wrong.
     if (argc < 4 || argc > 34) {
         error();
         return 1;
     }
     unsigned int N = std::atoi(argv[1]);
-    if (N < 1) {
+    if (N < 1 || N + 3 > unsigned(argc)) {
         error();
         return 2;
     }
 
-    std::vector<std::ifstream> files (&argv[3], &argv[N + 3]); //[first, last)
-    std::vector<std::thread> inputs (N);
-    for (unsigned x = 0; x < N; ++x) {
-        inputs[x] = std::thread(pread_n_people, &files[x]);
+    std::vector<std::string> files (&argv[3], &argv[N + 3]); //[first, last)
+    Arena = person_arena(N);
+    try {
+        output_writer output(argv[2]);
+        if (offline) sort_offline(files, output);
+        else         sort_online (files, output);
+        output.close();
+    } catch (std::system_error& se) {
+        std::cerr << se.what() << std::endl;
+        return 3;
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 4;
     }
-    std::ofstream output(argv[2]);
-    // begin processing the priority queue in the main thread
-    bool done = false, got = false;
-    unsigned waitedFor = 0;
-    Person p;
-    while (!done) {
-        got = People_Queue.wait_for_and_pop(p, std::chrono::milliseconds(10));
-        done = std::none_of(inputs.begin(), inputs.end(), [](auto&& x) {
-            return x.joinable();
-        });
-        if (got) {
-            output << p << std::endl;
-            waitedFor = 0;
-        } else {
-            if (++waitedFor > 10) {
-                done = true;
-                std::cout << "Exited due to timeout.\n";
-            }
-        }
-    }
-    // std::vector<bool> success (N); unsigned i = 0;
-    for (auto&& th: inputs) th.join();
     std::cout << "Received " << countIn << " objects. " << std::endl;
+    if (counted) (offline ? Offline_Perf : Online_Perf).report(std::cout);
     std::cout << "Exiting." << std::endl;
     return 0;
 }
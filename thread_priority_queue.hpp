@@ -7,17 +7,22 @@
 //*  A thread-safe priority queue implementation, based on the principles of
 //*  Anthony Williams's "C++ Concurrency in Action".
 //*  Implemented for Dijkstra's Algorithm
+//*  Compiled as C++20, it also has co_await pop() for coroutines (coro.hpp).
 
 #ifndef thread_priority_queue_hpp
 #define thread_priority_queue_hpp
 
 #include "structs_fwd.hpp"
+#include "instrument.hpp"
 #include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <algorithm> // std::make_heap, push_heap, pop_heap
 
 #include <memory> // std::shared_ptr
+#ifdef __cpp_impl_coroutine
+#include "coro.hpp"
+#endif
 
 namespace david {
     namespace thread {
@@ -35,18 +40,38 @@ namespace david {
         protected:
             Container mData;
             Compare   comp;
-            mutable std::mutex mMut;
-            std::condition_variable mCondVar;
+            mutable instrument::mutex mMut;
+            instrument::condition_variable mCondVar;
+#ifdef DAVID_THREAD_INSTRUMENT
+            /** Push time of each element of mData, at the same index: the
+            *   heap operations below move both together. */
+            std::vector<std::uint64_t> mStamps;
+            instrument::histogram mSojourn;
+#endif
+#ifdef __cpp_impl_coroutine
+            //* Coroutines in pop(); only ever waiting while mData is empty.
+            coro::waiter_list<T> mWaiters;
+#endif
             //* Convenience typedefs
-            using LGuard = std::lock_guard<std::mutex>;
-            using ULock = std::unique_lock<std::mutex>;
+            using LGuard = std::lock_guard<instrument::mutex>;
+            using ULock = std::unique_lock<instrument::mutex>;
 
         private:
-            /** Private pop member function. Requires mutex to be locked.
+            /** Private pop_top member function. Requires mutex to be locked.
             *   Removes the top element of the priority queue, and internally
             *   sorts according to comp to preserve invariants.
             *   Called by all the public thread-safe pop function variants. */
-            void pop() {
+            void pop_top() {
+#ifdef DAVID_THREAD_INSTRUMENT
+                if (mStamps.size() == mData.size()) {
+                    mSojourn.record(instrument::now() - mStamps.front());
+                    sift_down();
+                    mStamps.pop_back();
+                    mData.pop_back();
+                    return;
+                }
+                mStamps.clear(); // out of step after a throw; stop stamping
+#endif
                 std::pop_heap(mData.begin(), mData.end(), comp);
                 mData.pop_back();
             }
@@ -56,10 +81,96 @@ namespace david {
             *   sorts according to comp to preserve invariants.
             *   Called by all the public thread-safe push function variants. */
             void push_sort() {
+#ifdef DAVID_THREAD_INSTRUMENT
+                if (mStamps.size() + 1 == mData.size()) {
+                    mStamps.push_back(instrument::now());
+                    sift_up();
+                    mCondVar.notify_one();
+                    return;
+                }
+                mStamps.clear();
+#endif
                 std::push_heap(mData.begin(), mData.end(), comp);
                 mCondVar.notify_one();
             }
 
+#ifdef DAVID_THREAD_INSTRUMENT
+            //* std::push_heap on mData, moving mStamps in step.
+            void sift_up() {
+                using std::swap;
+                size_type i = mData.size() - 1;
+                while (i > 0) {
+                    size_type p = (i - 1) / 2;
+                    if (!comp(mData[p], mData[i])) break;
+                    swap(mData[p], mData[i]);
+                    swap(mStamps[p], mStamps[i]);
+                    i = p;
+                }
+            }
+
+            //* std::pop_heap on mData, moving mStamps in step.
+            void sift_down() {
+                using std::swap;
+                size_type n = mData.size() - 1, i = 0;
+                swap(mData[0], mData[n]);
+                swap(mStamps[0], mStamps[n]);
+                for (size_type c; (c = 2 * i + 1) < n; i = c) {
+                    if (c + 1 < n && comp(mData[c], mData[c + 1])) ++c;
+                    if (!comp(mData[i], mData[c])) break;
+                    swap(mData[i], mData[c]);
+                    swap(mStamps[i], mStamps[c]);
+                }
+            }
+
+            //* Stamps the elements the queue was constructed with.
+            void stamp_all() {
+                mStamps.assign(mData.size(), instrument::now());
+            }
+#else
+            void stamp_all() {}
+#endif
+
+#ifdef __cpp_impl_coroutine
+            template <class, typename> friend class coro::pop_awaiter;
+            using awaiter = coro::pop_awaiter<thread_priority_queue, T>;
+
+            ULock lock() const { return ULock(mMut); }
+            coro::waiter_list<T>& waiters() { return mWaiters; }
+
+            //* Moves the top element into @param v. Requires mMut.
+            bool take(std::optional<T>& v) {
+                if (mData.empty()) return false;
+                v.emplace(std::move_if_noexcept(mData.front()));
+                pop_top();
+                return true;
+            }
+
+            /** Gives @param val to the oldest coroutine waiting in pop(), if
+            *   there is one, and resumes it once @param lk is released. The
+            *   queue is empty while any wait, so val is the top element.
+            *   @return: whether there was one. */
+            bool hand_over(ULock& lk, value_type& val) {
+                if (mWaiters.empty()) return false;
+                coro::waiter<T>* w = mWaiters.pop();
+                w->value.emplace(std::move_if_noexcept(val));
+#ifdef DAVID_THREAD_INSTRUMENT
+                mSojourn.record(0);
+#endif
+                lk.unlock();
+                w->resume();
+                return true;
+            }
+
+            //* Moves the waiters it can feed now to @param ready. Needs mMut.
+            void feed(coro::waiter_list<T>& ready) {
+                while (!mWaiters.empty() && !mData.empty()) {
+                    coro::waiter<T>* w = mWaiters.pop();
+                    take(w->value);
+                    ready.push(w);
+                }
+            }
+#endif
+
         public:
             /**
              *  @brief  Default constructor creates no elements.
@@ -67,13 +178,19 @@ namespace david {
             explicit
             thread_priority_queue(const Compare& __x, const Container& __c)
             : mData(__c), comp(__x)
-            { std::make_heap(mData.begin(), mData.end(), comp); }
+            {
+                std::make_heap(mData.begin(), mData.end(), comp);
+                stamp_all();
+            }
 
             explicit
             thread_priority_queue(const Compare& __x = Compare(),
       		     Container&& __c = Container())
             : mData(std::move(__c)), comp(__x)
-            { std::make_heap(mData.begin(), mData.end(), comp); }
+            {
+                std::make_heap(mData.begin(), mData.end(), comp);
+                stamp_all();
+            }
 
             ~thread_priority_queue() = default;
 
@@ -96,6 +213,7 @@ namespace david {
             {
                 mData.insert(mData.end(), __first, __last);
                 std::make_heap(mData.begin(), mData.end(), comp);
+                stamp_all();
             }
 
             template<typename InputIterator>
@@ -105,12 +223,13 @@ namespace david {
             {
                 mData.insert(mData.end(), __first, __last);
                 std::make_heap(mData.begin(), mData.end(), comp);
+                stamp_all();
             }
             /** @return: whether the current thread_queue is empty */
             bool empty() const noexcept(
                 noexcept(declval<container_type>().empty()))
             {
-                std::lock_guard<std::mutex> lk(mMut);
+                LGuard lk(mMut);
                 return mData.empty();
             }
 
@@ -118,7 +237,7 @@ namespace david {
             size_type size() const noexcept(
                 noexcept(declval<container_type>().size()))
             {
-                std::lock_guard<std::mutex> lk(mMut);
+                LGuard lk(mMut);
                 return mData.size();
             }
 
@@ -131,13 +250,23 @@ namespace david {
             *  sequence.
             */
             void push(const value_type& __x) {
-                std::lock_guard<std::mutex> lk(mMut);
+                ULock lk(mMut);
+#ifdef __cpp_impl_coroutine
+                if (!mWaiters.empty()) {
+                    value_type val (__x);
+                    hand_over(lk, val);
+                    return;
+                }
+#endif
                 mData.push_back(__x);
                 push_sort();
             }
 
             void push(value_type&& __x) {
-                LGuard lk(mMut);
+                ULock lk(mMut);
+#ifdef __cpp_impl_coroutine
+                if (hand_over(lk, __x)) return;
+#endif
                 mData.push_back(std::move(__x));
                 push_sort();
             }
@@ -147,7 +276,14 @@ namespace david {
             *   container for back-emplacement */
             template<typename... Args>
             void emplace(Args&&... args) {
-                LGuard lk(mMut);
+                ULock lk(mMut);
+#ifdef __cpp_impl_coroutine
+                if (!mWaiters.empty()) {
+                    value_type val (std::forward<Args>(args)...);
+                    hand_over(lk, val);
+                    return;
+                }
+#endif
                 mData.emplace_back(std::forward<Args>(args)...);
                 push_sort();
             }
@@ -165,7 +301,7 @@ namespace david {
                 if (mData.empty())
                     return false;
                 value = mData.front();
-                pop();
+                pop_top();
                 return true;
             }
 
@@ -177,10 +313,11 @@ namespace david {
                 LGuard lk(mMut);
                 if (mData.empty())
                     return pointer();
-                pointer res(std::make_shared<value_type>(
+                pointer res(std::allocate_shared<value_type>(
+                    mData.get_allocator(),
                     std::move_if_noexcept(mData.front())
                 ));
-                pop();
+                pop_top();
                 return res;
             }
 
@@ -190,10 +327,10 @@ namespace david {
             *   @param value is overwritten with the previous top
             *   value, which is removed from the queue. */
             void wait_and_pop(T& value) {
-                std::unique_lock<std::mutex> lk (mMut);
+                ULock lk(mMut);
                 mCondVar.wait(lk, [this]{return !mData.empty();});
                 value = std::move_if_noexcept(mData.front());
-                pop();
+                pop_top();
             }
 
             /** wait_and_pop() overload returning std::shared_ptr to previous
@@ -203,12 +340,13 @@ namespace david {
             *   @return: shared_ptr to value popped from queue, or the default
             *   std::shared_ptr (nullptr) if the pop was unsuccessful */
             pointer wait_and_pop() {
-                std::unique_lock<std::mutex> lk (mMut);
+                ULock lk(mMut);
                 mCondVar.wait(lk, [this]{return !mData.empty();});
-                pointer res(std::make_shared<value_type>(
+                pointer res(std::allocate_shared<value_type>(
+                    mData.get_allocator(),
                     std::move_if_noexcept(mData.front())
                 ));
-                pop();
+                pop_top();
                 return res;
             }
 
@@ -223,11 +361,11 @@ namespace david {
             bool wait_for_and_pop(T& value,
                 const std::chrono::duration<Rep, Period>& d)
             {
-                std::unique_lock<std::mutex> lk (mMut);
+                ULock lk(mMut);
                 bool b=mCondVar.wait_for(lk, d, [this]{return !mData.empty();});
                 if (!b) return false;
                 value = std::move_if_noexcept(mData.front());
-                pop();
+                pop_top();
                 return true;
             }
 
@@ -241,26 +379,66 @@ namespace david {
             template <typename Rep, class Period = std::ratio<1> >
             pointer wait_for_and_pop(const std::chrono::duration<Rep, Period>&d)
             {
-                std::unique_lock<std::mutex> lk (mMut);
+                ULock lk(mMut);
                 bool b=mCondVar.wait_for(lk, d, [this]{return !mData.empty();});
                 if (!b) return pointer();
-                pointer res(std::make_shared<value_type>(
+                pointer res(std::allocate_shared<value_type>(
+                    mData.get_allocator(),
                     std::move_if_noexcept(mData.front())
                 ));
-                pop();
+                pop_top();
                 return res;
             }
 
+#ifdef __cpp_impl_coroutine
+            /** Coroutine pop: co_await q.pop() yields the top element,
+            *   suspending the coroutine (not its thread) until there is
+            *   one. A waiting coroutine is handed the next pushed element
+            *   ahead of any thread in wait_and_pop, and is resumed on its
+            *   executor (coro.hpp). */
+            awaiter pop() { return awaiter(*this); }
+#endif
+
             /** A transactional swap member function.
             * @param <rhs>: thread_priority_queue to swap with *this */
             void swap(thread_priority_queue& rhs) {
                 if (this == &rhs) return;
-                std::lock(mMut, rhs.mMut);
-                using std::swap;
-                LGuard lock_a(mMut,     std::adopt_lock);
-                LGuard lock_b(rhs.mMut, std::adopt_lock);
-                swap(mData, rhs.mData);
-                swap(comp,  rhs.comp);
+#ifdef __cpp_impl_coroutine
+                // waiters stay with their queue, and take what it now holds
+                coro::waiter_list<T> ready;
+#endif
+                {
+                    std::lock(mMut, rhs.mMut);
+                    using std::swap;
+                    LGuard lock_a(mMut,     std::adopt_lock);
+                    LGuard lock_b(rhs.mMut, std::adopt_lock);
+                    swap(mData, rhs.mData);
+                    swap(comp,  rhs.comp);
+#ifdef DAVID_THREAD_INSTRUMENT
+                    swap(mStamps, rhs.mStamps);
+#endif
+#ifdef __cpp_impl_coroutine
+                    feed(ready);
+                    rhs.feed(ready);
+#endif
+                }
+#ifdef __cpp_impl_coroutine
+                while (!ready.empty()) ready.pop()->resume();
+#endif
+            }
+
+            /** @return: this queue's lock, wait and sojourn statistics so
+            *   far; see instrument.hpp. Does not take the lock. Empty, with
+            *   enabled == false, unless built with DAVID_THREAD_INSTRUMENT. */
+            instrument::queue_stats stats() const {
+                instrument::queue_stats s;
+#ifdef DAVID_THREAD_INSTRUMENT
+                s.enabled = true;
+                s.lock = mMut.stats();
+                s.waits = mCondVar.stats();
+                s.sojourn = mSojourn.snapshot();
+#endif
+                return s;
             }
 
         };
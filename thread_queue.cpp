@@ -6,62 +6,101 @@
 //
 //  Test of my thread_queue
 
+//  The words are split straight out of the mapped files by tokenizer.hpp,
+//  and travel through the queue as batches of std::string_views.
+
+//  compile this file with -std=c++17 or higher.
+
 #include <iostream>
-#include <fstream>
-#include <sstream>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <memory>
 #include <thread>
 #include <future>
 #include <chrono>
+#include <algorithm>
 #include "thread_queue.hpp"
+#include "sequenced_queue.hpp"
+#include "tokenizer.hpp"
 
 using namespace david::thread;
+using david::io::mapped_file;
+using david::io::token_batch;
 
 constexpr unsigned ROW_BOAT_WORDS = 18;
 constexpr unsigned BLA_BLA_BLAH_WORDS = 332;
+//* Words per batch: small, so that every singer gets some of the song
+constexpr std::size_t VERSE_WORDS = 16;
 
-void processIfstream(std::ifstream* piss, std::deque<std::string>* pds) {
-    auto&& is = *piss; auto&& ds = *pds;
-    std::string word, line;
-    while( std::getline(is, line) ) {
-        std::stringstream buffer(line);
-        //std::cout << line << std::endl << std::flush;
-        while (buffer >> word) ds.push_back(word);
-    }
+/*  Splits @file into words, in parallel chunks, pushing batches of them
+*   into @ptq. The batches keep the file mapped. */
+std::size_t processFile(std::shared_ptr<const mapped_file> file,
+    thread_queue<token_batch>* ptq) {
+    auto&& tq = *ptq;
+    std::size_t words = david::io::tokenize(std::move(file),
+        [&tq](token_batch&& batch) { tq.push(std::move(batch)); },
+        std::thread::hardware_concurrency(), VERSE_WORDS);
     std::endl(std::cout);
+    return words;
 };
 
 std::atomic<bool> Singing;
 constexpr std::chrono::milliseconds span (100);
 
-void singOutOfTune (thread_queue<std::string>* ptq) {
+void singOutOfTune (thread_queue<token_batch>* ptq) {
     auto&& tq = *ptq;
-    std::vector<std::string> thread_lyrics (tq.size());
-    std::size_t i = 0;
-    for (; !tq.empty(); ++i) {
-        // tq.wait_and_pop(thread_lyrics[i]);
-        if (!tq.wait_for_and_pop(thread_lyrics[i], span)) {
+    // the batches themselves are kept, so their words stay mapped
+    std::vector<token_batch> thread_lyrics;
+    token_batch batch;
+    while (!tq.empty()) {
+        if (!tq.wait_for_and_pop(batch, span)) {
             bool b = false;
             for (auto attempt = 0; attempt <= 10 && !b; ++attempt) {
-                b = tq.wait_for_and_pop(thread_lyrics[i], span);
+                b = tq.wait_for_and_pop(batch, span);
                 if (attempt == 10) std::this_thread::yield();
             }
+            if (!b) continue;
         }
+        thread_lyrics.push_back(std::move(batch));
     }
     unsigned j = 0;
-    for (auto it = thread_lyrics.begin(), jt = it + i; it != jt; ++it, ++j) {
-        std::cout << *it << ' ';
-        if (j % 5 == 4) std::cout << std::endl; // << std::flush;
+    for (auto&& verse : thread_lyrics)
+        for (auto&& word : verse.tokens) {
+            std::cout << word << ' ';
+            if (j % 5 == 4) std::cout << std::endl; // << std::flush;
+            if (j % 20 == 19) std::cout << std::endl << std::flush;
+            ++j;
+        }
+}
+
+/*  The same song, sung by the same crowd of threads, but through a
+*   sequenced_queue: each thread takes whichever word comes next, and the
+*   queue releases them in the order they were pushed. */
+void singInTune (sequenced_queue<std::string_view>* psq) {
+    auto&& sq = *psq;
+    std::size_t seq;
+    std::string_view word;
+    while (sq.wait_and_pop(seq, word)) sq.complete(seq, std::move(word));
+}
+
+void listen (sequenced_queue<std::string_view>* psq) {
+    auto&& sq = *psq;
+    std::string_view word;
+    for (unsigned j = 0; sq.pop_result(word); ++j) {
+        std::cout << word << ' ';
+        if (j % 5 == 4) std::cout << std::endl;
         if (j % 20 == 19) std::cout << std::endl << std::flush;
     }
 }
 
 int main()
 {
-    std::ifstream input1 ("resources/hamlet.txt");
-    std::ifstream input2 ("resources/kesha.txt");
-    if (!(input1.is_open() && input2.is_open())) {
+    std::shared_ptr<const mapped_file> input1, input2;
+    try {
+        input1 = std::make_shared<const mapped_file>("resources/hamlet.txt");
+        input2 = std::make_shared<const mapped_file>("resources/kesha.txt");
+    } catch (std::system_error&) {
         std::cout << "Unable to open input files." << std::endl;
         return 1;
     }
@@ -75,9 +114,9 @@ int main()
     // unsigned num_threads = 3*(hwc_ ? hwc_ - 1: 4);
     std::cout << num_threads << " threads available. (" << hwc_ << ")\n";
 
-    std::deque<std::string> boatDec, keshaDec;
-    auto fut1 = std::async (std::launch::async, processIfstream, &input1,
-        &boatDec);
+    thread_queue<token_batch> tqRowBoat, tqKesha;
+    auto fut1 = std::async (std::launch::async, processFile, input1,
+        &tqRowBoat);
 
     // do something while waiting for function to set future:
     std::cout << "Processing file resources/hamlet.txt" << std::endl;
@@ -85,8 +124,8 @@ int main()
         std::cout << '.' << std::flush;
 
     fut1.get();
+    input1.reset(); // the batches in the queue keep hamlet mapped
 
-    thread_queue<std::string> tqRowBoat(std::move(boatDec));
     std::cout << "Done processing row_your_boat.txt." << std::endl
         << "Preparing to sing out of key." << std::endl;
     std::vector<std::thread> songThreads (num_threads);
@@ -101,12 +140,14 @@ int main()
     std::cout << std::endl << std::endl << "Beautiful." << std::endl << '\n';
 
     std::cout << "Processing file resources/kesha.txt:" << std::endl;
-    auto fut2 = std::async (std::launch::async, processIfstream, &input2,
-        &keshaDec);
+    auto fut2 = std::async (std::launch::async, processFile, input2,
+        &tqKesha);
     while (fut2.wait_for(span)==std::future_status::timeout)
         std::cout << '.' << std::flush;
     fut2.get();
-    thread_queue<std::string> tqKesha (std::move(keshaDec));
+    std::vector<std::string_view> keshaSheet; // for the encore, in order
+    david::io::for_each_token(input2->begin(), input2->end(),
+        [&keshaSheet](std::string_view word) { keshaSheet.push_back(word); });
     std::cout << "Done processing kesha.txt." << std::endl
         << "Preparing to sing drunk with autotune." << std::endl;
     Singing = true;
@@ -119,6 +160,21 @@ int main()
     Singing = false;
     std::cout <<"\n\n*************\nZip your lip like a padlock.\n" <<std::endl;
 
+    std::cout << "Encore, in tune this time." << std::endl;
+    songThreads.resize(std::max<std::size_t>(songThreads.size(), 2));
+    sequenced_queue<std::string_view> sqKesha (4 * songThreads.size());
+    for (auto&& th : songThreads) {
+        th = std::thread(singInTune, &sqKesha);
+    }
+    std::thread audience (listen, &sqKesha);
+    for (auto&& word : keshaSheet) sqKesha.push(word);
+    sqKesha.close();
+    for (auto && th : songThreads) {
+        th.join();
+    }
+    audience.join();
+    std::cout << "\n\n*************\nNow that's autotune.\n" << std::endl;
+
     // I know I could do these concurrently, but it's funnier this way
 
     return 0;
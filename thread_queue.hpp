@@ -6,15 +6,20 @@
 //
 //*  A thread-safe queue implementation, based on that in
 //*  Anthony Williams's "C++ Concurrency in Action"
+//*  Compiled as C++20, it also has co_await pop() for coroutines (coro.hpp).
 
 #ifndef thread_queue_hpp
 #define thread_queue_hpp
 
 #include "structs_fwd.hpp"
+#include "instrument.hpp"
 #include <deque>
 #include <mutex>
 #include <condition_variable>
 #include <memory> // std::shared_ptr
+#ifdef __cpp_impl_coroutine
+#include "coro.hpp"
+#endif
 
 namespace david {
     namespace thread {
@@ -30,13 +35,84 @@ namespace david {
             using size_type  =      std::size_t;
         private:
             container_type mData;
-            mutable std::mutex mMut;
-            std::condition_variable mCondVar;
+            mutable instrument::mutex mMut;
+            instrument::condition_variable mCondVar;
+#ifdef DAVID_THREAD_INSTRUMENT
+            //* Push time of each element of mData, in the same order.
+            std::deque<std::uint64_t> mStamps;
+            instrument::histogram mSojourn;
+#endif
+#ifdef __cpp_impl_coroutine
+            //* Coroutines in pop(); only ever waiting while mData is empty.
+            coro::waiter_list<T> mWaiters;
+#endif
             //* Convenience typedefs
-            using LGuard = std::lock_guard<std::mutex>;
-            using ULock = std::unique_lock<std::mutex>;
+            using LGuard = std::lock_guard<instrument::mutex>;
+            using ULock = std::unique_lock<instrument::mutex>;
             // using _share = std::make_shared<value_type>;
             // template <typename U> using _transfer = std::move_if_noexcept<U>;
+
+            //* Notes the push time of the element just pushed. Requires mMut.
+            void stamp() {
+#ifdef DAVID_THREAD_INSTRUMENT
+                mStamps.push_back(instrument::now());
+#endif
+            }
+
+            /** Removes the front element, recording its sojourn if
+            *   instrumented. Requires mMut. */
+            void pop_front() {
+#ifdef DAVID_THREAD_INSTRUMENT
+                if (mStamps.size() == mData.size()) {
+                    mSojourn.record(instrument::now() - mStamps.front());
+                    mStamps.pop_front();
+                } else {
+                    // out of step after a throw; back in once it drains
+                    mStamps.clear();
+                }
+#endif
+                mData.pop_front();
+            }
+
+#ifdef __cpp_impl_coroutine
+            template <class, typename> friend class coro::pop_awaiter;
+            using awaiter = coro::pop_awaiter<thread_queue, T>;
+
+            ULock lock() const { return ULock(mMut); }
+            coro::waiter_list<T>& waiters() { return mWaiters; }
+
+            //* Moves the front element into @param v. Requires mMut.
+            bool take(std::optional<T>& v) {
+                if (mData.empty()) return false;
+                v.emplace(std::move_if_noexcept(mData.front()));
+                pop_front();
+                return true;
+            }
+
+            /** Gives @param val to the oldest coroutine waiting in pop(), if
+            *   there is one, and resumes it once @param lk is released.
+            *   @return: whether there was one. */
+            bool hand_over(ULock& lk, value_type& val) {
+                if (mWaiters.empty()) return false;
+                coro::waiter<T>* w = mWaiters.pop();
+                w->value.emplace(std::move_if_noexcept(val));
+#ifdef DAVID_THREAD_INSTRUMENT
+                mSojourn.record(0);
+#endif
+                lk.unlock();
+                w->resume();
+                return true;
+            }
+
+            //* Moves the waiters it can feed now to @param ready. Needs mMut.
+            void feed(coro::waiter_list<T>& ready) {
+                while (!mWaiters.empty() && !mData.empty()) {
+                    coro::waiter<T>* w = mWaiters.pop();
+                    take(w->value);
+                    ready.push(w);
+                }
+            }
+#endif
         public:
             //* Default constructor. Constructs empty thread_queue.
             thread_queue() {};
@@ -46,13 +122,20 @@ namespace david {
             thread_queue(const thread_queue& tq) {
                 LGuard lk(tq.mMut);
                 mData = tq.mData;
+#ifdef DAVID_THREAD_INSTRUMENT
+                mStamps = tq.mStamps;
+#endif
             }
 
             /** Constructor adapting an rvalue reference to container_type,
             *   using it as the thread_queue's underlying container.
             *   @param <C>: the Container to become the basis of this
             *   thread_queue object */
-            explicit thread_queue(container_type&& C) : mData(std::move(C)) {};
+            explicit thread_queue(container_type&& C) : mData(std::move(C)) {
+#ifdef DAVID_THREAD_INSTRUMENT
+                mStamps.assign(mData.size(), instrument::now());
+#endif
+            };
 
             //* Copy assignment is deleted.
             thread_queue& operator=(const thread_queue& tq) = delete;
@@ -65,8 +148,12 @@ namespace david {
             /** Push an object to the thread_queue by value.
             *   @param <val>: value to be pushed to the thread_queue */
             void push(value_type val) {
-                std::lock_guard<std::mutex> lk(mMut);
+                ULock lk(mMut);
+#ifdef __cpp_impl_coroutine
+                if (hand_over(lk, val)) return;
+#endif
                 mData.push_back(std::move_if_noexcept(val));
+                stamp();
                 mCondVar.notify_one();
             }
 
@@ -82,7 +169,7 @@ namespace david {
                 if (mData.empty())
                     return false;
                 value = mData.front();
-                mData.pop_front();
+                pop_front();
                 return true;
             }
 
@@ -94,10 +181,11 @@ namespace david {
                 LGuard lk(mMut);
                 if (mData.empty())
                     return pointer {};
-                pointer res(std::make_shared<value_type>(
+                pointer res(std::allocate_shared<value_type>(
+                    mData.get_allocator(),
                     std::move_if_noexcept(mData.front())
                 ));
-                mData.pop_front();
+                pop_front();
                 return res;
             }
 
@@ -107,10 +195,10 @@ namespace david {
             *   @param value is overwritten with the previous top
             *   value, which is removed from the queue. */
             void wait_and_pop(T& value) {
-                std::unique_lock<std::mutex> lk (mMut);
+                ULock lk(mMut);
                 mCondVar.wait(lk, [this]{return !mData.empty();});
                 value = std::move_if_noexcept(mData.front());
-                mData.pop_front();
+                pop_front();
             }
 
             /** wait_and_pop() overload returning std::shared_ptr to previous
@@ -120,12 +208,13 @@ namespace david {
             *   @return: shared_ptr to value popped from queue, or the default
             *   std::shared_ptr (nullptr) if the pop was unsuccessful */
             pointer wait_and_pop() {
-                std::unique_lock<std::mutex> lk (mMut);
+                ULock lk(mMut);
                 mCondVar.wait(lk, [this]{return !mData.empty();});
-                pointer res(std::make_shared<value_type>(
+                pointer res(std::allocate_shared<value_type>(
+                    mData.get_allocator(),
                     std::move_if_noexcept(mData.front())
                 ));
-                mData.pop_front();
+                pop_front();
                 return res;
             }
 
@@ -140,11 +229,11 @@ namespace david {
             bool wait_for_and_pop(T& value,
                 const std::chrono::duration<Rep, Period>& d)
             {
-                std::unique_lock<std::mutex> lk (mMut);
+                ULock lk(mMut);
                 bool b=mCondVar.wait_for(lk, d, [this]{return !mData.empty();});
                 if (!b) return false;
                 value = std::move_if_noexcept(mData.front());
-                mData.pop_front();
+                pop_front();
                 return true;
             }
 
@@ -158,23 +247,41 @@ namespace david {
             template <typename Rep, class Period = std::ratio<1> >
             pointer wait_for_and_pop(const std::chrono::duration<Rep, Period>&d)
             {
-                std::unique_lock<std::mutex> lk (mMut);
+                ULock lk(mMut);
                 bool b=mCondVar.wait_for(lk, d, [this]{return !mData.empty();});
                 if (!b) return pointer();
-                pointer res(std::make_shared<value_type>(
+                pointer res(std::allocate_shared<value_type>(
+                    mData.get_allocator(),
                     std::move_if_noexcept(mData.front())
                 ));
-                mData.pop_front();
+                pop_front();
                 return res;
             }
 
+#ifdef __cpp_impl_coroutine
+            /** Coroutine pop: co_await q.pop() yields the front element,
+            *   suspending the coroutine (not its thread) until there is
+            *   one. A waiting coroutine is handed the next pushed element
+            *   ahead of any thread in wait_and_pop, and is resumed on its
+            *   executor (coro.hpp). */
+            awaiter pop() { return awaiter(*this); }
+#endif
+
             /** Emplacement function.
             *   @param <args...>: parameter pack to forward to underlying
             *   container for back-emplacement */
             template<typename... Args>
             void emplace(Args&&... args) {
-                std::unique_lock<std::mutex> lk (mMut);
+                ULock lk(mMut);
+#ifdef __cpp_impl_coroutine
+                if (!mWaiters.empty()) {
+                    value_type val (std::forward<Args>(args)...);
+                    hand_over(lk, val);
+                    return;
+                }
+#endif
                 mData.emplace_back(std::forward<Args>(args)...);
+                stamp();
                 mCondVar.notify_one();
             }
 
@@ -182,7 +289,7 @@ namespace david {
             bool empty() const noexcept(
                 noexcept(declval<container_type>().empty()))
             {
-                std::lock_guard<std::mutex> lk(mMut);
+                LGuard lk(mMut);
                 return mData.empty();
             }
 
@@ -190,7 +297,7 @@ namespace david {
             size_type size() const noexcept(
                 noexcept(declval<container_type>().size()))
             {
-                std::lock_guard<std::mutex> lk(mMut);
+                LGuard lk(mMut);
                 return mData.size();
             }
 
@@ -206,10 +313,41 @@ namespace david {
             * @param <rhs>: thread_queue to swap with *this */
             void swap(thread_queue& rhs) {
                 if (this == &rhs) return;
-                std::lock(mMut, rhs.mMut);
-                LGuard lock_a(mMut,     std::adopt_lock);
-                LGuard lock_b(rhs.mMut, std::adopt_lock);
-                swap(mData, rhs.mData);
+#ifdef __cpp_impl_coroutine
+                // waiters stay with their queue, and take what it now holds
+                coro::waiter_list<T> ready;
+#endif
+                {
+                    std::lock(mMut, rhs.mMut);
+                    LGuard lock_a(mMut,     std::adopt_lock);
+                    LGuard lock_b(rhs.mMut, std::adopt_lock);
+                    using std::swap;
+                    swap(mData, rhs.mData);
+#ifdef DAVID_THREAD_INSTRUMENT
+                    swap(mStamps, rhs.mStamps);
+#endif
+#ifdef __cpp_impl_coroutine
+                    feed(ready);
+                    rhs.feed(ready);
+#endif
+                }
+#ifdef __cpp_impl_coroutine
+                while (!ready.empty()) ready.pop()->resume();
+#endif
+            }
+
+            /** @return: this queue's lock, wait and sojourn statistics so
+            *   far; see instrument.hpp. Does not take the lock. Empty, with
+            *   enabled == false, unless built with DAVID_THREAD_INSTRUMENT. */
+            instrument::queue_stats stats() const {
+                instrument::queue_stats s;
+#ifdef DAVID_THREAD_INSTRUMENT
+                s.enabled = true;
+                s.lock = mMut.stats();
+                s.waits = mCondVar.stats();
+                s.sojourn = mSojourn.snapshot();
+#endif
+                return s;
             }
 
             // friend void swap(thread_queue& lhs, thread_queue& rhs);
@@ -18,10 +18,9 @@
 
 namespace david {
     namespace thread {
-        struct empty_stack : public std::length::error {
-            static constexpr char err_msg[] = "empty stack.";
-            const char* what() const noexcept { return err_msg; }
-        }
+        struct empty_stack : public std::length_error {
+            empty_stack() : std::length_error("empty stack.") {}
+        };
 
         template <typename T, class Container = std::deque<T> >
         class thread_stack {
@@ -35,6 +34,8 @@ namespace david {
         private:
             container_type mData;
             mutable std::mutex mMut;
+            //* Convenience typedefs
+            using LGuard = std::lock_guard<std::mutex>;
 
         public:
             //* Default constructor. Constructs empty thread_stack.
@@ -82,7 +83,8 @@ namespace david {
             pointer try_pop() {
                 std::lock_guard<std::mutex> lk(mMut);
                 if (mData.empty()) throw empty_stack();
-                pointer res(std::make_shared<value_type>(
+                pointer res(std::allocate_shared<value_type>(
+                    mData.get_allocator(),
                     std::move_if_noexcept(mData.back())
                 ));
                 mData.pop_back();
@@ -129,6 +131,7 @@ namespace david {
                 std::lock(mMut, rhs.mMut);
                 LGuard lock_a(mMut,     std::adopt_lock);
                 LGuard lock_b(rhs.mMut, std::adopt_lock);
+                using std::swap;
                 swap(mData, rhs.mData);
             }
 
@@ -0,0 +1,145 @@
+//
+//  tokenizer.hpp
+//  thread_support
+//
+//*  Zero-copy word splitting for mapped text. Tokens are std::string_views
+//*  straight into a mapped_file, found 64 bytes at a time from a whitespace
+//*  bitmask (SSE2 on x86-64, a plain loop elsewhere), so no token is ever
+//*  copied or allocated. tokenize() splits a file into newline-aligned
+//*  chunks, scans them in parallel on the shared task_pool, and hands the
+//*  tokens on in batches, each holding a shared_ptr to the mapping: the
+//*  text stays mapped until the last batch is gone, however long the
+//*  consumers keep them.
+//*  Compile with -std=c++17 or higher.
+
+#ifndef tokenizer_hpp
+#define tokenizer_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>     // std::memcpy, std::memset
+#include <memory>
+#include <string_view>
+#include <vector>
+#include <atomic>
+#include <utility>     // std::exchange
+#include "mapped_file.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace david {
+    namespace io {
+        //* Whitespace as std::isspace sees it in the "C" locale.
+        constexpr bool is_space(char c) noexcept {
+            return c == ' ' || (c >= '\t' && c <= '\r');
+        }
+
+        /** @return: a mask whose bit i is set when @param p[i] is
+        *   whitespace, for the 64 bytes at @param p. */
+        inline std::uint64_t whitespace_mask(const char* p) noexcept {
+            std::uint64_t mask = 0;
+#if defined(__SSE2__)
+            const __m128i space = _mm_set1_epi8(' ');
+            const __m128i tab   = _mm_set1_epi8('\t');
+            const __m128i span  = _mm_set1_epi8('\r' - '\t');
+            for (unsigned k = 0; k < 4; ++k) {
+                __m128i x = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(p + 16 * k));
+                // '\t'..'\r' are the bytes x with x - '\t' <= 4, unsigned
+                __m128i ctl = _mm_sub_epi8(x, tab);
+                __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(x, space),
+                    _mm_cmpeq_epi8(_mm_min_epu8(ctl, span), ctl));
+                mask |= std::uint64_t(std::uint16_t(_mm_movemask_epi8(ws)))
+                    << (16 * k);
+            }
+#else
+            for (unsigned i = 0; i < 64; ++i)
+                mask |= std::uint64_t(is_space(p[i])) << i;
+#endif
+            return mask;
+        }
+
+        /** Calls @param fn(std::string_view) for every whitespace-separated
+        *   token in [@param first, @param last), in order. */
+        template <class Fn>
+        void for_each_token(const char* first, const char* last, Fn&& fn) {
+            std::uint64_t prev_ws = 1;  // whether the byte before is a space
+            const char* start = first;
+            for (const char* p = first; p < last; p += 64) {
+                std::uint64_t ws;
+                if (last - p >= 64) ws = whitespace_mask(p);
+                else {
+                    // the tail, padded with spaces to end its last token
+                    char tail[64];
+                    std::memset(tail, ' ', sizeof tail);
+                    std::memcpy(tail, p, last - p);
+                    ws = whitespace_mask(tail);
+                }
+                std::uint64_t after_ws = ws << 1 | prev_ws;
+                std::uint64_t starts = ~ws & after_ws, ends = ws & ~after_ws;
+                prev_ws = ws >> 63;
+                // starts and ends alternate, so take them in bit order
+                for (std::uint64_t marks = starts | ends; marks;
+                    marks &= marks - 1)
+                {
+                    unsigned i = __builtin_ctzll(marks);
+                    if (starts >> i & 1) start = p + i;
+                    else fn(std::string_view(start, p + i - start));
+                }
+            }
+            if (!prev_ws) fn(std::string_view(start, last - start));
+        }
+
+        /** Up to batch_size tokens of one chunk of a file. Batches of a
+        *   chunk are numbered from 0, and the last one says so, so a
+        *   consumer that cares can put the words back in file order. */
+        struct token_batch {
+            std::shared_ptr<const mapped_file> source; // keeps tokens valid
+            std::size_t chunk = 0, index = 0;
+            bool last = false;
+            std::vector<std::string_view> tokens;
+        };
+
+        /** Splits @param source into up to @param parts newline-aligned
+        *   chunks and tokenizes them as tasks on the shared task_pool
+        *   (for_each_chunk), calling @param sink(token_batch&&) for every
+        *   batch of up to @param batch_size tokens. sink is called from
+        *   several threads at once; thread_queue::push is a fine one. A
+        *   sink that blocks must not wait on work queued to the pool.
+        *   @return: the number of tokens. */
+        template <class Sink>
+        std::size_t tokenize(std::shared_ptr<const mapped_file> source,
+            Sink&& sink, std::size_t parts, std::size_t batch_size = 4096)
+        {
+            if (!source || source->empty()) return 0;
+            if (batch_size == 0) batch_size = 1;
+            auto chunks = split_lines(source->begin(), source->end(), parts);
+            std::atomic<std::size_t> count {0};
+            for_each_chunk(chunks, [&](std::size_t c, const text_chunk& text)
+            {
+                token_batch batch {source, c, 0, false, {}};
+                batch.tokens.reserve(batch_size);
+                std::size_t n = 0;
+                for_each_token(text.first, text.last,
+                    [&](std::string_view word) {
+                        if (batch.tokens.size() == batch_size) {
+                            n += batch_size;
+                            token_batch next {source, c, batch.index + 1,
+                                false, {}};
+                            next.tokens.reserve(batch_size);
+                            sink(std::exchange(batch, std::move(next)));
+                        }
+                        batch.tokens.push_back(word);
+                    });
+                n += batch.tokens.size();
+                batch.last = true;
+                sink(std::move(batch));
+                count += n;
+            });
+            return count;
+        }
+    }
+}
+
+#endif /* tokenizer_hpp */
@@ -0,0 +1,352 @@
+//
+//  word_count.cpp
+//  thread_support
+//
+//  Word frequencies and the top K terms of text files, through the
+//  tokenizer and a thread_queue.
+//  Usage: word_count [-j T] [-k K] [--raw] [--repeat R] [--scale] {files}
+//  (default resources/hamlet.txt). The files are tokenized in parallel
+//  chunks (tokenizer.hpp), and T counter threads pop token_batches off one
+//  thread_queue, each counting into its own open-addressing word_table,
+//  so counting takes no locks. The tables are then split by hash into T
+//  partitions, merged a partition per task on the shared task_pool, and
+//  each partition's top K is found by std::partial_sort before the final
+//  K are picked from those candidates.
+//  Terms have leading and trailing punctuation stripped and ignore case;
+//  --raw counts the tokens exactly as they are. --repeat feeds every file
+//  R times, to measure a multi-GB corpus without storing one, and --scale
+//  repeats the count for 1, 2, 4 ... T counters and prints the curve.
+
+//  compile this file with -std=c++17 or higher.
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>     // std::memcpy
+#include "thread_queue.hpp"
+#include "pool_allocator.hpp"
+#include "parallel_algorithms.hpp"
+#include "tokenizer.hpp"
+
+using namespace david::thread;
+using david::io::mapped_file;
+using david::io::token_batch;
+using Clock = std::chrono::steady_clock;
+
+inline unsigned char fold(unsigned char c, bool ignore_case) noexcept {
+    return ignore_case && c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+//* Lowercases the ASCII letters among the 8 bytes of @param x at once.
+inline std::uint64_t fold8(std::uint64_t x) noexcept {
+    constexpr std::uint64_t ones = 0x0101010101010101ull;
+    std::uint64_t low = x & (0x7f * ones);              // keeps no carries
+    std::uint64_t at_least_A = low + (0x80 - 'A') * ones;
+    std::uint64_t past_Z = low + (0x80 - 'Z' - 1) * ones;
+    std::uint64_t upper = at_least_A & ~past_Z & ~x & (0x80 * ones);
+    return x | upper >> 2;                              // 0x80 >> 2 == 'a' - 'A'
+}
+
+//* @return: the @param n <= 8 bytes at @param p, zero-padded.
+inline std::uint64_t load8(const char* p, std::size_t n) noexcept {
+    std::uint64_t x = 0;
+    std::memcpy(&x, p, n);
+    return x;
+}
+
+//* Hashes 8 bytes at a time, then mixes so the low bits (the index) vary.
+inline std::uint64_t word_hash(std::string_view w, bool ignore_case) noexcept
+{
+    std::uint64_t h = w.size() * 0x9e3779b97f4a7c15ull;
+    for (std::size_t i = 0; i < w.size(); i += 8) {
+        std::uint64_t x = load8(w.data() + i, std::min<std::size_t>(8,
+            w.size() - i));
+        h = (h ^ (ignore_case ? fold8(x) : x)) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ull; h ^= h >> 33;
+    return h;
+}
+
+inline bool same_word(std::string_view a, std::string_view b,
+    bool ignore_case) noexcept {
+    if (a.size() != b.size()) return false;
+    if (!ignore_case) return a == b;
+    for (std::size_t i = 0; i < a.size(); i += 8) {
+        std::size_t n = std::min<std::size_t>(8, a.size() - i);
+        if (fold8(load8(a.data() + i, n)) != fold8(load8(b.data() + i, n)))
+            return false;
+    }
+    return true;
+}
+
+//* @return: @param w without leading or trailing ASCII punctuation.
+inline std::string_view trim_term(std::string_view w) noexcept {
+    auto inner = [](unsigned char c) {
+        return c >= 0x80 || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')
+            || (c >= 'A' && c <= 'Z');
+    };
+    std::size_t b = 0, e = w.size();
+    while (b < e && !inner(w[b])) ++b;
+    while (e > b && !inner(w[e - 1])) --e;
+    return w.substr(b, e - b);
+}
+
+struct word_count {
+    std::string_view word;
+    std::uint64_t    hash, count;
+};
+
+//* Most frequent first; ties in alphabetical order, ignoring case first.
+inline bool more_frequent(const word_count& a, const word_count& b) {
+    if (a.count != b.count) return a.count > b.count;
+    auto folded_less = [](unsigned char x, unsigned char y) {
+        return fold(x, true) < fold(y, true);
+    };
+    if (std::lexicographical_compare(a.word.begin(), a.word.end(),
+        b.word.begin(), b.word.end(), folded_less)) return true;
+    if (std::lexicographical_compare(b.word.begin(), b.word.end(),
+        a.word.begin(), a.word.end(), folded_less)) return false;
+    return a.word < b.word;
+}
+
+/** Open-addressing (linear probing) table from words to counts, for one
+*   thread. Words are views, never copies; among spellings that compare
+*   equal, the smallest is kept, so the result does not depend on which
+*   thread saw which spelling first. */
+class word_table {
+    std::vector<word_count> mSlots;  // count 0: empty
+    std::size_t mUsed = 0;
+    bool mIgnoreCase;
+
+    void grow() {
+        std::vector<word_count> old (std::max<std::size_t>(64,
+            2 * mSlots.size()));
+        old.swap(mSlots);
+        mUsed = 0;
+        for (auto&& s : old) if (s.count) add(s);
+    }
+
+public:
+    explicit word_table(bool ignore_case = true)
+    : mSlots(1024), mIgnoreCase(ignore_case) {}
+
+    void add(std::string_view w) { add(word_count {w,
+        word_hash(w, mIgnoreCase), 1}); }
+
+    void add(const word_count& wc) {
+        if (2 * (mUsed + 1) > mSlots.size()) grow(); // at most half full
+        std::size_t mask = mSlots.size() - 1;
+        for (std::size_t i = wc.hash & mask; ; i = (i + 1) & mask) {
+            auto&& s = mSlots[i];
+            if (!s.count) { s = wc; ++mUsed; return; }
+            if (s.hash == wc.hash && same_word(s.word, wc.word, mIgnoreCase))
+            {
+                s.count += wc.count;
+                if (wc.word < s.word) s.word = wc.word;
+                return;
+            }
+        }
+    }
+
+    std::size_t size() const noexcept { return mUsed; }
+
+    //* Calls @param fn(const word_count&) for every word.
+    template <class Fn>
+    void for_each(Fn&& fn) const {
+        for (auto&& s : mSlots) if (s.count) fn(s);
+    }
+};
+
+/** Bounds the batches in flight, so that the tokenizer can't run gigabytes
+*   ahead of the counters. */
+class batch_credits {
+    std::size_t mFree;
+    std::mutex mMut;
+    std::condition_variable mCv;
+    using LGuard = std::lock_guard<std::mutex>;
+    using ULock = std::unique_lock<std::mutex>;
+public:
+    explicit batch_credits(std::size_t n) : mFree(n) {}
+    void acquire() {
+        ULock lk(mMut);
+        mCv.wait(lk, [this]{ return mFree > 0; });
+        --mFree;
+    }
+    void release() {
+        { LGuard lk(mMut); ++mFree; }
+        mCv.notify_one();
+    }
+};
+
+struct count_result {
+    std::uint64_t tokens = 0, terms = 0, distinct = 0;
+    std::vector<word_count> top;
+    double seconds = 0;
+};
+
+/*  Runs fn(i) for every i in [0, n), one thread each (this one included).
+*   Only the counters use it, since they block on the queue and pool tasks
+*   must not. */
+template <class Fn>
+void on_threads(unsigned n, Fn fn) {
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < n; ++i) threads.emplace_back(fn, i);
+    fn(0);
+    for (auto&& th : threads) th.join();
+}
+
+count_result count_words(const std::vector<std::shared_ptr<const mapped_file>>&
+    files, unsigned threads, unsigned repeat, std::size_t k, bool raw)
+{
+    auto start = Clock::now();
+    count_result res;
+    thread_queue<token_batch, pool_deque<token_batch> > queue;
+    batch_credits credits (8 * threads);
+    std::vector<word_table> tables (threads, word_table(!raw));
+    std::vector<std::uint64_t> terms (threads);
+
+    // a batch with no source tells a counter to stop
+    std::thread producer ([&]() {
+        for (unsigned r = 0; r < repeat; ++r)
+            for (auto&& f : files)
+                res.tokens += david::io::tokenize(f,
+                    [&](token_batch&& b) {
+                        credits.acquire();
+                        queue.push(std::move(b));
+                    }, threads);
+        for (unsigned t = 0; t < threads; ++t) queue.push(token_batch {});
+    });
+    on_threads(threads, [&](unsigned t) {
+        auto&& table = tables[t];
+        token_batch b;
+        std::uint64_t n = 0;
+        for (queue.wait_and_pop(b); b.source; queue.wait_and_pop(b)) {
+            credits.release();
+            for (auto w : b.tokens) {
+                if (!raw && (w = trim_term(w)).empty()) continue;
+                table.add(w);
+                ++n;
+            }
+        }
+        terms[t] = n;
+    });
+    producer.join();
+
+    // parallel reduction: partition p of every table goes to merger p
+    auto part_of = [threads](std::uint64_t h) {
+        return std::size_t((unsigned __int128)h * threads >> 64);
+    };
+    std::vector<std::vector<std::vector<word_count>>> parts (threads,
+        std::vector<std::vector<word_count>>(threads));
+    parallel_for(0u, threads, [&](unsigned t) {
+        tables[t].for_each([&](const word_count& wc) {
+            parts[t][part_of(wc.hash)].push_back(wc);
+        });
+        tables[t] = word_table(); // its words are in parts[t] now
+    }, 1u);
+    std::vector<std::vector<word_count>> tops (threads);
+    std::vector<std::size_t> distinct (threads);
+    parallel_for(0u, threads, [&](unsigned p) {
+        word_table merged (!raw);
+        for (unsigned t = 0; t < threads; ++t)
+            for (auto&& wc : parts[t][p]) merged.add(wc);
+        auto&& top = tops[p];
+        merged.for_each([&top](const word_count& wc) { top.push_back(wc); });
+        distinct[p] = top.size();
+        auto mid = top.begin() + std::min(k, top.size());
+        std::partial_sort(top.begin(), mid, top.end(), more_frequent);
+        top.erase(mid, top.end());
+    }, 1u);
+    for (unsigned p = 0; p < threads; ++p) {
+        res.top.insert(res.top.end(), tops[p].begin(), tops[p].end());
+        res.distinct += distinct[p];
+        res.terms += terms[p];
+    }
+    auto mid = res.top.begin() + std::min(k, res.top.size());
+    std::partial_sort(res.top.begin(), mid, res.top.end(), more_frequent);
+    res.top.erase(mid, res.top.end());
+    res.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return res;
+}
+
+inline void argError() {
+    std::cerr << "Usage: word_count [-j T] [-k K] [--raw] [--repeat R] "
+        << "[--scale] {files}\n"
+        << "-j (--threads) T  counting threads (default: one per core)\n"
+        << "-k K              how many of the most frequent terms to list "
+        << "(default 10)\n"
+        << "--raw             count tokens as they are, punctuation and case"
+        << " included\n"
+        << "--repeat R        read every file R times (default 1)\n"
+        << "--scale           time 1, 2, 4 ... T threads\n"
+        << "{files} default to resources/hamlet.txt\n";
+}
+
+void report(unsigned threads, const count_result& res, double base) {
+    std::cout << threads << " threads: " << res.tokens << " words in "
+        << res.seconds << " s, " << res.tokens / res.seconds / 1e6
+        << " M words/s, speedup " << base / res.seconds << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned hwc = std::thread::hardware_concurrency();
+    unsigned threads = hwc ? hwc : 4, repeat = 1;
+    std::size_t k = 10;
+    bool raw = false, scale = false;
+    for (; argc > 1 && argv[1][0] == '-'; --argc, ++argv) {
+        std::string flag (argv[1]);
+        if (flag == "--raw") { raw = true; continue; }
+        if (flag == "--scale") { scale = true; continue; }
+        if (argc < 3) { argError(); return 1; }
+        if (flag == "-j" || flag == "--threads")
+            threads = std::max(1, std::atoi(argv[2]));
+        else if (flag == "-k") k = std::strtoull(argv[2], nullptr, 10);
+        else if (flag == "--repeat") repeat = std::max(1, std::atoi(argv[2]));
+        else { argError(); return 1; }
+        --argc; ++argv;
+    }
+    std::vector<std::string> names (argv + 1, argv + argc);
+    if (names.empty()) names.push_back("resources/hamlet.txt");
+    std::vector<std::shared_ptr<const mapped_file>> files;
+    std::uint64_t bytes = 0;
+    try {
+        for (auto&& name : names) {
+            files.push_back(std::make_shared<const mapped_file>(name));
+            bytes += files.back()->size() * repeat;
+        }
+    } catch (std::system_error& se) {
+        std::cerr << se.what() << std::endl;
+        return 2;
+    }
+    std::cout << "Counting " << bytes << " bytes of text." << std::endl;
+
+    count_result res;
+    double base = 0;
+    if (scale) {
+        for (unsigned t = 1; t < threads; t *= 2) {
+            res = count_words(files, t, repeat, k, raw);
+            if (t == 1) base = res.seconds;
+            report(t, res, base);
+        }
+    }
+    res = count_words(files, threads, repeat, k, raw);
+    report(threads, res, base ? base : res.seconds);
+    std::cout << res.terms << " terms, " << res.distinct << " distinct.\n";
+    for (std::size_t i = 0; i < res.top.size(); ++i) {
+        std::string word (res.top[i].word);
+        for (auto&& c : word) c = fold(c, !raw);
+        std::cout << i + 1 << '\t' << res.top[i].count << '\t' << word << '\n';
+    }
+    return 0;
+}